@@ -0,0 +1,62 @@
+#include "driver.h"
+#include "net.h"
+
+#ifdef TCP
+#include "socket.h"
+
+#define ECHO_PORT 60000
+#define ECHO_MAX_EVENTS 64
+
+/**
+ * @brief 把连接上可读的数据原样写回，对端关闭时关闭套接字
+ *
+ * @param fd    套接字描述符
+ */
+static void echo(int fd) {
+    uint8_t buf[4096];
+    for (;;) {
+        ssize_t len = sock_read(fd, buf, sizeof(buf));
+        if (len == 0) {  // 对端已关闭
+            sock_close(fd);
+            return;
+        }
+        if (len < 0)
+            return;
+        if (sock_write(fd, buf, len) < len) {  // 简化处理：发送缓冲区满时丢弃未写入的部分
+            printf("send buffer full on fd %d.\n", fd);
+            return;
+        }
+    }
+}
+#endif
+
+int main(int argc, char const *argv[]) {
+    if (net_init() == -1) {  // 初始化协议栈
+        printf("net init failed.");
+        return -1;
+    }
+
+#ifdef TCP
+    sock_init();
+    int poller = sock_poller_create();
+    int listen_fd = sock_listen(ECHO_PORT);
+    sock_poller_ctl(poller, SOCK_CTL_ADD, listen_fd, SOCK_POLLIN);
+
+    sock_event_t events[ECHO_MAX_EVENTS];
+    while (1) {
+        int n = sock_poller_wait(poller, events, ECHO_MAX_EVENTS, -1);  // 轮询协议栈直到有套接字就绪
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].fd;
+            if (fd == listen_fd) {
+                int conn_fd;
+                while ((conn_fd = sock_accept(listen_fd, NULL, NULL)) >= 0)
+                    sock_poller_ctl(poller, SOCK_CTL_ADD, conn_fd, SOCK_POLLIN);
+            } else if (events[i].events & SOCK_POLLIN) {
+                echo(fd);
+            }
+        }
+    }
+#endif
+
+    return 0;
+}
@@ -3,6 +3,10 @@
 
 #ifdef TCP
 #include "tcp.h"
+#include "worker.h"
+
+#include <stdlib.h>
+
 void tcp_handler(tcp_conn_t *tcp_conn, uint8_t *data, size_t len, uint8_t *src_ip, uint16_t src_port) {
     for (int i = 0; i < len; i++)
         putchar(data[i]);
@@ -12,6 +16,18 @@ void tcp_handler(tcp_conn_t *tcp_conn, uint8_t *data, size_t len, uint8_t *src_i
 
     tcp_send(tcp_conn, data, len, 60000, src_ip, src_port);  // 发送tcp包
 }
+
+void worker_handler(uint32_t conn, const uint8_t *data, size_t len) {
+    if (len == 0) {  // 对端已关闭
+        worker_shutdown(conn);
+        return;
+    }
+    fwrite(data, 1, len, stdout);
+    putchar('\n');
+    fflush(stdout);
+
+    worker_send(conn, data, len);  // 交给协议栈线程发送
+}
 #endif
 
 int main(int argc, char const *argv[]) {
@@ -21,10 +37,22 @@ int main(int argc, char const *argv[]) {
     }
 
 #ifdef TCP
-    tcp_open(60000, tcp_handler);  // 注册端口的tcp监听回调
+    int workers = argc > 1 ? atoi(argv[1]) : 0;  // 可选参数：工作线程数
+    if (workers > 0) {
+        if (worker_init(workers) == -1) {
+            printf("worker init failed.");
+            return -1;
+        }
+        worker_open(60000, worker_handler);  // 收到的数据交给工作线程处理
+    } else {
+        tcp_open(60000, tcp_handler);  // 注册端口的tcp监听回调
+    }
 #endif
 
     while (1) {
+#ifdef TCP
+        worker_poll();  // 发送工作线程的响应
+#endif
         net_poll();  // 一次主循环
     }
 
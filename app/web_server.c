@@ -1,9 +1,11 @@
 #include "driver.h"
+#include "coro.h"
 #include "net.h"
-#include "tcp.h"
 
 #define HTTP_MAX_PATH_LENGTH 1024
 #define HTTP_MAX_RESPONSE_LENGTH 1024
+#define HTTP_MAX_REQUEST_LENGTH 4096
+#define HTTP_BODY_CHUNK_LENGTH (16 * 1024)  // 每次读取的响应体长度，在协程栈上，需小于 CORO_STACK_SIZE
 #define HTTP_LISTEN_PORT 80
 
 /**
@@ -30,25 +32,19 @@ static inline const char *http_get_mime_type(const char *file_path) {
 /**
  * @brief 响应函数
  *
- * @param tcp_conn  指向当前 TCP 连接的指针
+ * @param fd        连接的套接字描述符
  * @param url_path  资源文件路径
- * @param port      本连接端口
- * @param dst_ip    目标 IP 地址
- * @param dst_port  目标端口
  */
-void http_respond(tcp_conn_t *tcp_conn, char *url_path, uint16_t port, uint8_t *dst_ip, uint16_t dst_port) {
-    FILE *file;
+void http_respond(int fd, char *url_path) {
+    FILE *file = NULL;
     char file_path[HTTP_MAX_PATH_LENGTH];
-    memcpy(file_path, HTTP_RESOURCE_DIR, sizeof(HTTP_RESOURCE_DIR));
 
-    // 获取文件路径，打开文件
-    if (strcmp(url_path, "/") == 0) {  // 如果路径为 "/", 则默认打开 index.html
-        strcat(file_path, "/index.html");
-    } else {
-        strcat(file_path, url_path);  // 否则，文件路径为 "${HTTP_RESOURCE_DIR}${url_path}"
-    }
-    // 打开文件
-    file = fopen(file_path, "rb");
+    // 获取文件路径：如果路径为 "/", 则默认打开 index.html，否则文件路径为 "${HTTP_RESOURCE_DIR}${url_path}"
+    const char *name = strcmp(url_path, "/") == 0 ? "/index.html" : url_path;
+    int len = snprintf(file_path, sizeof(file_path), "%s%s", HTTP_RESOURCE_DIR, name);
+    // 打开文件。拼接后过长的路径和含有 ".." 的路径（可能逃出资源目录）按文件不存在处理
+    if (len >= 0 && (size_t)len < sizeof(file_path) && name[0] == '/' && !strstr(name, ".."))
+        file = fopen(file_path, "rb");
 
     char resp_buffer[HTTP_MAX_RESPONSE_LENGTH] = {0};
 
@@ -62,87 +58,125 @@ void http_respond(tcp_conn_t *tcp_conn, char *url_path, uint16_t port, uint8_t *
         /* Step1 ：发送 HTTP 404 请求头 */
         // 发送 HTTP 状态行
         sprintf(resp_buffer, "HTTP/1.1 404 Not Found\r\n");
-        tcp_send(tcp_conn, (uint8_t *)resp_buffer, strlen(resp_buffer), port, dst_ip, dst_port);
+        coro_write(fd, (uint8_t *)resp_buffer, strlen(resp_buffer));
 
         // 发送 HTTP 连接信息
         sprintf(resp_buffer, "Connection: Keep-Alive\r\n");
-        tcp_send(tcp_conn, (uint8_t *)resp_buffer, strlen(resp_buffer), port, dst_ip, dst_port);
+        coro_write(fd, (uint8_t *)resp_buffer, strlen(resp_buffer));
 
         // 发送 HTTP 内容类型
         sprintf(resp_buffer, "Content-Type: text/html; charset=utf-8\r\n");
-        tcp_send(tcp_conn, (uint8_t *)resp_buffer, strlen(resp_buffer), port, dst_ip, dst_port);
+        coro_write(fd, (uint8_t *)resp_buffer, strlen(resp_buffer));
 
         // 发送 HTTP 内容长度
         sprintf(resp_buffer, "Content-Length: %zu\r\n", strlen(not_found_body));
-        tcp_send(tcp_conn, (uint8_t *)resp_buffer, strlen(resp_buffer), port, dst_ip, dst_port);
+        coro_write(fd, (uint8_t *)resp_buffer, strlen(resp_buffer));
 
         // 发送 HTTP 响应头与响应体的分隔符
         sprintf(resp_buffer, "\r\n");
-        tcp_send(tcp_conn, (uint8_t *)resp_buffer, strlen(resp_buffer), port, dst_ip, dst_port);
+        coro_write(fd, (uint8_t *)resp_buffer, strlen(resp_buffer));
 
         // 发送 HTTP 响应体
-        tcp_send(tcp_conn, (uint8_t *)not_found_body, strlen(not_found_body), port, dst_ip, dst_port);
-
+        coro_write(fd, (uint8_t *)not_found_body, strlen(not_found_body));
         return;
     }
 
     /* Step2 ：发送 HTTP 请求头 */
     // 发送 HTTP 状态行
     sprintf(resp_buffer, "HTTP/1.1 200 OK\r\n");
-    tcp_send(tcp_conn, (uint8_t *)resp_buffer, strlen(resp_buffer), port, dst_ip, dst_port);
+    coro_write(fd, (uint8_t *)resp_buffer, strlen(resp_buffer));
 
     // 发送 HTTP 连接信息
     sprintf(resp_buffer, "Connection: Keep-Alive\r\n");
-    tcp_send(tcp_conn, (uint8_t *)resp_buffer, strlen(resp_buffer), port, dst_ip, dst_port);
+    coro_write(fd, (uint8_t *)resp_buffer, strlen(resp_buffer));
 
     const char *content_type = http_get_mime_type(file_path);
     // 发送 HTTP 内容类型，根据文件类型设置 MIME 类型
     sprintf(resp_buffer, "Content-Type: %s\r\n", content_type);
-    tcp_send(tcp_conn, (uint8_t *)resp_buffer, strlen(resp_buffer), port, dst_ip, dst_port);
+    coro_write(fd, (uint8_t *)resp_buffer, strlen(resp_buffer));
 
     fseek(file, 0, SEEK_END);
     size_t content_length = ftell(file);
     fseek(file, 0, SEEK_SET);
     // 发送 HTTP 内容长度
     sprintf(resp_buffer, "Content-Length: %zu\r\n", content_length);
-    tcp_send(tcp_conn, (uint8_t *)resp_buffer, strlen(resp_buffer), port, dst_ip, dst_port);
+    coro_write(fd, (uint8_t *)resp_buffer, strlen(resp_buffer));
 
     // 发送 HTTP 响应头与响应体的分隔符
     sprintf(resp_buffer, "\r\n");
-    tcp_send(tcp_conn, (uint8_t *)resp_buffer, strlen(resp_buffer), port, dst_ip, dst_port);
+    coro_write(fd, (uint8_t *)resp_buffer, strlen(resp_buffer));
 
     /* Step3 ：发送 HTTP 响应体 */
+    uint8_t body_buffer[HTTP_BODY_CHUNK_LENGTH];  // 不能是静态的，协程在读写之间可能被切换
     size_t bytes_read;
-    while ((bytes_read = fread(resp_buffer, 1, sizeof(resp_buffer), file)) > 0) {
-        // 每次发送读取的文件内容块
-        tcp_send(tcp_conn, (uint8_t *)resp_buffer, bytes_read, port, dst_ip, dst_port);
+    while ((bytes_read = coro_file_read(body_buffer, sizeof(body_buffer), file)) > 0) {
+        // 每次发送读取的文件内容块，发送缓冲区满时挂起，等待对端确认
+        if (coro_write(fd, body_buffer, bytes_read) < 0)
+            break;
     }
 
-    // 后处理: 关闭文件
+    // 后处理: 关闭文件。同一轮中写入的响应在本轮收包结束后合并成尽量少的报文段发出
     fclose(file);
 }
 
-void http_request_handler(tcp_conn_t *tcp_conn, uint8_t *data, size_t len, uint8_t *src_ip, uint16_t src_port) {
+/**
+ * @brief 处理一个请求
+ *
+ * @param fd    连接的套接字描述符
+ * @param data  以'\0'结尾的请求
+ */
+void http_request_handler(int fd, char *data) {
     char method[4];
     char url_path[HTTP_MAX_PATH_LENGTH];
 
     // 提取 HTTP 方法。目前仅支持 "GET" 请求
-    if (sscanf((char *)data, "%3s", method) != 1 || strcmp(method, "GET") != 0)
+    if (sscanf(data, "%3s", method) != 1 || strcmp(method, "GET") != 0)
         return;
 
     // 获取请求 URL
     int idx = 0;
     int j = 0;
-    while (data[idx] != ' ')
+    while (data[idx] && data[idx] != ' ')
+        ++idx;
+    if (data[idx])
         ++idx;
-    ++idx;
-    while (data[idx] != ' ') {
+    while (data[idx] && data[idx] != ' ' && j < HTTP_MAX_PATH_LENGTH - 1) {
         url_path[j++] = data[idx++];
     }
     url_path[j] = '\0';
 
     // 发送响应
-    http_respond(tcp_conn, url_path, HTTP_LISTEN_PORT, src_ip, src_port);
+    http_respond(fd, url_path);
+}
+
+/**
+ * @brief 连接的协程，依次读取并处理请求，对端关闭后关闭套接字
+ *
+ * @param arg   连接的套接字描述符
+ */
+void http_serve(void *arg) {
+    int fd = (intptr_t)arg;
+    char request[HTTP_MAX_REQUEST_LENGTH];
+    ssize_t len;
+    while ((len = coro_read(fd, request, sizeof(request) - 1)) > 0) {
+        request[len] = '\0';
+        http_request_handler(fd, request);
+    }
+    coro_close(fd);
+}
+
+/**
+ * @brief 监听套接字的协程，为每个新连接创建一个协程
+ *
+ * @param arg   监听套接字描述符
+ */
+void http_accept(void *arg) {
+    int listen_fd = (intptr_t)arg;
+    int fd;
+    while ((fd = coro_accept(listen_fd, NULL, NULL)) >= 0) {
+        if (coro_spawn(http_serve, (void *)(intptr_t)fd) < 0)
+            coro_close(fd);
+    }
 }
 
 int main(int argc, char const *argv[]) {
@@ -150,12 +184,15 @@ int main(int argc, char const *argv[]) {
         printf("net init failed.");
         return -1;
     }
-
-    tcp_open(HTTP_LISTEN_PORT, http_request_handler);  // 注册端口的tcp监听回调
-
-    while (1) {
-        net_poll();  // 一次主循环
+    sock_init();
+    if (coro_init() == -1) {
+        printf("coro init failed.");
+        return -1;
     }
 
+    int listen_fd = sock_listen(HTTP_LISTEN_PORT);
+    coro_spawn(http_accept, (void *)(intptr_t)listen_fd);
+    coro_run();  // 调度器主循环，其中轮询协议栈
+
     return 0;
 }
@@ -26,6 +26,6 @@ void arp_init();
 void arp_print();
 void arp_in(buf_t *buf, uint8_t *src_mac);
 void arp_out(buf_t *buf, uint8_t *ip);
-void arp_req(uint8_t *target_ip);
-void arp_resp(uint8_t *target_ip, uint8_t *target_mac);
+void arp_req(net_if_t *netif, uint8_t *target_ip);
+void arp_resp(net_if_t *netif, uint8_t *target_ip, uint8_t *target_mac);
 #endif
\ No newline at end of file
@@ -6,8 +6,12 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+struct net_if;
+
 typedef struct buf  // 协议栈的通用数据包buffer, 可以在头部装卸数据，以供协议头的添加和去除
 {
+    struct net_if *netif;          // 收包时为入口网卡，发包时为出口网卡
+    uint8_t csum_ok;               // 传输层校验和已校验通过（如GRO合并的包），上层无需再次校验
     size_t len;                    // 包中有效数据大小
     uint8_t *data;                 // 包的数据起始地址
     uint8_t payload[BUF_MAX_LEN];  // 最大负载数据量
@@ -21,13 +21,34 @@
     }  // 自定义网卡mac地址
 #endif
 
-#define ETHERNET_MAX_TRANSPORT_UNIT 1500  // 以太网最大传输单元
+#define NET_IF_PREFIX_LEN 24  // 网卡默认子网前缀长度
+#define NET_IF_MAX_NUM 4      // 最多同时管理的网卡数量
+
+#define NET_RX_BURST 16  // 每次轮询从一个网卡连续接收的最大包数
+#define NET_RX_BUDGET 8  // 每次轮询从一个网卡接收的初始包数，发现丢包时逐步提高到NET_RX_BURST
+
+#define ETHERNET_MAX_TRANSPORT_UNIT 1500    // 以太网最大传输单元
+#define ETHERNET_JUMBO_TRANSPORT_UNIT 9000  // 巨型帧最大传输单元，运行时MTU的上限
+#define NET_IF_MTU ETHERNET_MAX_TRANSPORT_UNIT  // 网卡默认MTU，可通过net_if_set_mtu在运行时修改
+
+#define DRIVER_IMMEDIATE_MODE 1                // 默认以即时模式抓包，包到达即递交用户态
+#define DRIVER_TIMEOUT_MS 10                   // 非即时模式下内核攒批的读超时(毫秒)
+#define DRIVER_BUFFER_SIZE (4 * 1024 * 1024)  // 内核抓包缓冲区大小，容纳突发流量
+#define DRIVER_BUFFER_MAX_SIZE (64 * 1024 * 1024)  // 自动调整时内核抓包缓冲区的上限
+#define DRIVER_AUTOTUNE 1                          // 发现内核丢包时自动提高轮询预算和缓冲区大小
+#define DRIVER_STATS_INTERVAL 1                    // 查询抓包统计的间隔(秒)
+#define DRIVER_STATS_REPORT 0                      // 每次查询后打印抓包统计和时延分布，开启时才记录每个包的时延
 
 #define ARP_TIMEOUT_SEC (60 * 5)  // arp表过期时间
 #define ARP_MIN_INTERVAL 1        // 向相同地址发送arp请求的最小间隔
 
 #define IP_DEFALUT_TTL 64  // IP默认TTL
 
+#define TCP_MAX_CONN_NUM 65536    // TCP 连接数上限，连接池按需扩充到该值
+#define TCP_CONN_HASH_SIZE 65536  // TCP 连接表的哈希桶数，须为2的幂
+
+#define CACHE_LINE_SIZE 64  // 缓存行大小，频繁访问的数据按缓存行对齐
+
 #define BUF_MAX_LEN (2 * UINT16_MAX + UINT8_MAX)  // buf最大长度
 
 #define MAP_MAX_LEN (16 * BUF_MAX_LEN)  // map最大长度
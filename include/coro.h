@@ -0,0 +1,24 @@
+#ifndef CORO_H
+#define CORO_H
+
+#include "socket.h"
+
+#include <stdio.h>
+
+#define CORO_MAX_NUM SOCK_MAX_NUM   // 同时存在的协程数上限
+#define CORO_STACK_SIZE (64 * 1024)  // 每个协程的栈大小，协程结束后栈留在池中复用
+#define CORO_MAX_EVENTS 64           // 调度器每轮最多唤醒的等待套接字的协程数
+
+typedef void (*coro_fn_t)(void *arg);
+
+int coro_init();
+int coro_spawn(coro_fn_t fn, void *arg);
+void coro_yield();
+int coro_wait(int fd, uint32_t events);
+int coro_close(int fd);
+int coro_accept(int fd, uint8_t *src_ip, uint16_t *src_port);
+ssize_t coro_read(int fd, void *buf, size_t len);
+ssize_t coro_write(int fd, const void *buf, size_t len);
+size_t coro_file_read(void *buf, size_t len, FILE *file);
+void coro_run();
+#endif
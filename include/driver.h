@@ -6,8 +6,13 @@
 #ifndef PCAP_BUF_SIZE
 #define PCAP_BUF_SIZE 1024
 #endif
-int driver_open();
-int driver_recv(buf_t *buf);
-int driver_send(buf_t *buf);
-void driver_close();
+#define DRIVER_FILTER_MAX_LEN 4096  // 包过滤表达式最大长度，超出时退化为只按mac过滤
+
+int driver_open(net_if_t *netif);
+int driver_set_filter(net_if_t *netif);
+int driver_recv(net_if_t *netif, buf_t *buf);
+int driver_send(net_if_t *netif, buf_t *buf);
+void driver_close(net_if_t *netif);
+int driver_stats(net_if_t *netif);
+void driver_print_stats(net_if_t *netif);
 #endif
\ No newline at end of file
@@ -4,6 +4,8 @@
 #include "net.h"
 
 #define ETHERNET_MIN_TRANSPORT_UNIT 46  // 以太网最小传输单元
+#define ETHERNET_VLAN_TPID 0x8100       // 802.1Q标签协议标识
+#define ETHERNET_VLAN_ID_MASK 0x0fff    // TCI中的VLAN ID部分
 
 #pragma pack(1)
 
@@ -12,6 +14,11 @@ typedef struct ether_hdr {
     uint8_t src[NET_MAC_LEN];  // 源mac地址
     uint16_t protocol16;       // 协议/长度
 } ether_hdr_t;
+
+typedef struct vlan_hdr {
+    uint16_t tci16;       // 优先级、DEI与VLAN ID
+    uint16_t protocol16;  // 内层协议
+} vlan_hdr_t;
 #pragma pack()
 void ethernet_init();
 void ethernet_in(buf_t *buf);
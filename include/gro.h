@@ -0,0 +1,9 @@
+#ifndef GRO_H
+#define GRO_H
+
+#include "net.h"
+
+#define GRO_MAX_SIZE (UINT16_MAX - UINT8_MAX)  // 合并后IP数据报的最大长度
+
+size_t gro_receive(buf_t **bufs, size_t num);
+#endif
@@ -23,7 +23,9 @@ typedef struct ip_hdr {
 #define IP_HDR_OFFSET_PER_BYTE 8    // ip分片偏移长度单位
 #define IP_VERSION_4 4              // ipv4
 #define IP_MORE_FRAGMENT (1 << 13)  // ip分片mf位
+#define IP_FRAGMENT_OFFSET 0x1fff   // ip分片偏移字段
 void ip_in(buf_t *buf, uint8_t *src_mac);
 void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol);
+void ip_out_from(buf_t *buf, uint8_t *src_ip, uint8_t *ip, net_protocol_t protocol);
 void ip_init();
 #endif
\ No newline at end of file
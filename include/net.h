@@ -29,15 +29,72 @@ typedef enum net_protocol {
 
 typedef void (*net_handler_t)(buf_t *buf, uint8_t *src);
 
-#define NET_MAC_LEN 6  // mac地址长度
-#define NET_IP_LEN 4   // ip地址长度
+#define NET_MAC_LEN 6      // mac地址长度
+#define NET_IP_LEN 4       // ip地址长度
+#define NET_VLAN_NUM 4096  // 802.1Q VLAN ID数量
 
-extern uint8_t net_if_mac[NET_MAC_LEN];
-extern uint8_t net_if_ip[NET_IP_LEN];
-extern buf_t rxbuf, txbuf;  // 一个buf足够单线程使用
+#define NET_IF_LATENCY_BUCKETS 4  // 时延分布区间：<100us、<1ms、<10ms、>=10ms
+
+typedef struct net_if_capture  // 网卡抓包参数，可通过net_if_set_capture在运行时修改
+{
+    uint8_t immediate;  // 即时模式，包到达即递交用户态
+    int timeout;        // 非即时模式下的读超时(毫秒)
+    int buffer_size;    // 内核抓包缓冲区大小(字节)
+    uint8_t autotune;   // 发现丢包时是否自动调整
+    uint8_t report;     // 定期打印抓包统计和时延分布，开启时才记录每个包的时延
+} net_if_capture_t;
+
+typedef struct net_if_stats  // 网卡统计信息，重新打开网卡时清零
+{
+    uint64_t rx_packets;                          // 收到的包数
+    uint64_t latency_sum;                         // 内核抓包到用户态收到的时延总和(微秒)
+    uint64_t latency_max;                         // 最大时延(微秒)
+    uint64_t latency_hist[NET_IF_LATENCY_BUCKETS];  // 时延分布
+    uint32_t ps_recv;                             // 内核收到的包数，来自pcap_stats
+    uint32_t ps_drop;                             // 因缓冲区满被内核丢弃的包数
+    uint32_t ps_ifdrop;                           // 被网卡或驱动丢弃的包数
+} net_if_stats_t;
+
+typedef struct net_if  // 协议栈管理的一个网卡
+{
+    uint8_t index;             // 网卡序号
+    uint8_t mac[NET_MAC_LEN];  // 网卡mac地址
+    uint8_t ip[NET_IP_LEN];    // 网卡ip地址
+    uint8_t prefix_len;        // 子网前缀长度，用于路由选择
+    uint16_t mtu;              // 最大传输单元
+    uint16_t vlan_id;          // VLAN子网卡的VLAN ID
+    struct net_if *parent;     // VLAN子网卡所属的物理网卡，物理网卡为NULL
+    void *driver;              // 驱动句柄，由driver_open填写
+    net_if_capture_t capture;  // 物理网卡的抓包参数
+    net_if_stats_t stats;      // 物理网卡的统计信息
+    uint8_t rx_budget;         // 物理网卡每次轮询接收的最大包数，不超过NET_RX_BURST
+    uint8_t vlan_table[NET_VLAN_NUM];  // 物理网卡的VLAN ID到子网卡序号的直接映射表，0为未配置
+} net_if_t;
+
+typedef struct net_port  // 本机打开的一个传输层端口
+{
+    uint16_t protocol;   // 传输层协议号
+    uint16_t port;       // 端口号
+    uint16_t port_last;  // 端口范围的最后一个端口，单个端口时与 port 相同
+} net_port_t;
+
+extern net_if_t net_if_list[NET_IF_MAX_NUM];
+extern size_t net_if_num;
+extern buf_t txbuf;  // 一个buf足够单线程使用
+extern map_t net_port_table;
 
 int net_init();
 void net_poll();
 int net_in(buf_t *buf, uint16_t protocol, uint8_t *src);
 void net_add_protocol(uint16_t protocol, net_handler_t handler);
+int net_if_add(const uint8_t *ip, uint8_t prefix_len, const uint8_t *mac, uint16_t mtu);
+int net_if_add_vlan(net_if_t *parent, uint16_t vlan_id, const uint8_t *ip, uint8_t prefix_len);
+net_if_t *net_if_get(size_t index);
+net_if_t *net_if_route(const uint8_t *dst_ip);
+net_if_t *net_if_select(const uint8_t *src_ip, const uint8_t *dst_ip);
+int net_if_set_mtu(net_if_t *netif, uint16_t mtu);
+int net_if_set_capture(net_if_t *netif, uint8_t immediate, int timeout, int buffer_size);
+void net_port_open(uint16_t protocol, uint16_t port);
+void net_port_close(uint16_t protocol, uint16_t port);
+void net_port_range_open(uint16_t protocol, uint16_t first, uint16_t last);
 #endif
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef SOCKET_H
+#define SOCKET_H
+
+#include "tcp.h"
+
+#include <sys/types.h>
+
+#define SOCK_MAX_NUM (TCP_MAX_CONN_NUM + 64)        // 套接字表容量，包括监听套接字
+#define SOCK_POLLER_NUM 8                           // 多路复用器的个数
+#define SOCK_BACKLOG 128                            // 每个监听套接字上等待 sock_accept() 的连接数上限
+#define SOCK_SEND_BUFFER_SIZE TCP_SEND_BUFFER_SIZE  // 发送缓冲区中的数据达到该值时 sock_write() 返回 EAGAIN
+
+#define SOCK_POLLIN 0x001       // 有数据可读、对端已关闭，或有连接等待接受
+#define SOCK_POLLOUT 0x004      // 发送缓冲区有空间
+#define SOCK_POLLHUP 0x010      // 连接已释放，总是报告
+#define SOCK_POLLET 0x80000000  // 边沿触发：就绪后只报告一次，直到再次发生事件
+
+#define SOCK_CTL_ADD 1  // 把套接字注册到多路复用器
+#define SOCK_CTL_DEL 2  // 取消注册
+#define SOCK_CTL_MOD 3  // 修改关注的事件
+
+typedef struct sock_event {  // sock_poller_wait() 报告的一个就绪套接字
+    uint32_t events;         // 就绪的事件（SOCK_POLL*）
+    int fd;                  // 套接字
+} sock_event_t;
+
+void sock_init();
+int sock_listen(uint16_t port);
+int sock_accept(int fd, uint8_t *src_ip, uint16_t *src_port);
+int sock_connect(uint8_t *dst_ip, uint16_t dst_port);
+ssize_t sock_read(int fd, void *buf, size_t len);
+ssize_t sock_write(int fd, const void *buf, size_t len);
+int sock_shutdown(int fd);
+int sock_close(int fd);
+
+int sock_poller_create();
+int sock_poller_ctl(int poller, int op, int fd, uint32_t events);
+int sock_poller_wait(int poller, sock_event_t *events, int max_events, int timeout_ms);
+void sock_poller_close(int poller);
+#endif
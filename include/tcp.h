@@ -17,8 +17,9 @@ typedef struct tcp_hdr {
 } tcp_hdr_t;
 #pragma pack()
 
-typedef struct tcp_key {
+typedef struct tcp_key {  // 标识一个连接的四元组，多网卡时同一对端可以分别连接本机的不同地址
     uint8_t remote_ip[NET_IP_LEN];
+    uint8_t host_ip[NET_IP_LEN];
     uint16_t remote_port;
     uint16_t host_port;
 } tcp_key_t;
@@ -37,17 +38,154 @@ typedef enum tcp_state {
     TCP_STATE_LAST_ACK
 } tcp_state_t;
 
-typedef struct tcp_connection {
-    /* TCP connection states */
-    tcp_state_t state;
+#define TCP_OOO_SEG_SIZE 2048  // 乱序队列中每个节点的数据容量，较大的报文段拆分为多个节点
+#define TCP_OOO_POOL_NUM 512   // 所有连接共享的乱序队列节点数，每个连接缓存的数据不超过接收缓冲区容量
+
+typedef struct tcp_ooo_seg {  // 乱序到达的一段数据，按序列号排序且互不重叠
+    struct tcp_ooo_seg *next;
+    uint32_t seq;                   // 第一个字节的序列号
+    uint16_t len;                   // 数据长度
+    uint8_t fin;                    // 对端在这段数据之后结束发送
+    uint8_t data[TCP_OOO_SEG_SIZE];
+} tcp_ooo_seg_t;
+
+#define TCP_SACK_MAX_BLOCKS 4  // 一个报文段最多携带的 SACK 块数
+#define TCP_SACK_SCOREBOARD 8  // 发送方记录的 SACK 块数
+
+typedef struct tcp_sack_block {  // 一段连续的序列号 [start, end)
+    uint32_t start;
+    uint32_t end;
+} tcp_sack_block_t;
+
+typedef struct tcp_opts {  // 从报文段中解析出的选项
+    uint16_t mss;        // 未携带时为 TCP_DEFAULT_MSS
+    uint8_t wscale;      // 未携带时为 TCP_WSCALE_NONE
+    uint8_t sack_perm;
+    uint8_t ts;          // 是否携带时间戳
+    uint32_t tsval;
+    uint32_t tsecr;
+    uint8_t sack_num;
+    tcp_sack_block_t sack[TCP_SACK_MAX_BLOCKS];
+} tcp_opts_t;
+
+#define TCP_CC_PRIV_SIZE 8  // 拥塞控制算法私有状态的大小（以 uint64_t 计）
+
+struct tcp_connection;
+struct tcp_listener;
+typedef struct tcp_cc_ops {  // 拥塞控制算法
+    const char *name;
+    void (*init)(struct tcp_connection *tcp_conn);                     // 连接建立时初始化私有状态
+    void (*cong_avoid)(struct tcp_connection *tcp_conn, uint32_t acked);  // 拥塞避免阶段收到新的确认
+    uint32_t (*ssthresh)(struct tcp_connection *tcp_conn);             // 检测到丢包时计算新的慢启动阈值
+} tcp_cc_ops_t;
+
+typedef struct tcp_connection {  // 按访问频率分组，按序收到数据时只访问前三个缓存行
+    /* 热数据：连接表查找和首部预测检查的字段，占第一个缓存行 */
+    _Alignas(CACHE_LINE_SIZE) struct tcp_connection *hash_next;  // 连接表中同一哈希桶的下一个连接，空闲时为连接池空闲链表的下一个
+    tcp_key_t key;                 // 连接的四元组
+    tcp_state_t state;             // 连接池中的空闲连接为 TCP_STATE_CLOSED
+    uint32_t seq;                  // 要发送的序列号
+    uint32_t ack;                  // 要发送的 ACK
+    uint32_t snd_una;              // 最早的未确认序列号
+    uint32_t snd_max;              // 已发送的最大序列号，超时后 seq 回退到 snd_una 重新发送
+    uint32_t snd_wnd;              // 对端通告的接收窗口
+    uint32_t ts_recent;            // 对端最近的时间戳，在 TSecr 中回显
+    uint8_t snd_wscale;            // 对端窗口的扩大因子
+    uint8_t ts_ok;                 // 对端使用时间戳
+    uint8_t snd_ctl;               // 尚未被确认的 SYN/FIN，各占一个序列号
+    uint8_t in_recovery;           // 是否处于快速恢复
+    uint8_t dupacks;               // 连续重复 ACK 的个数
     uint8_t not_send_empty_ack;
+    uint8_t deferred;              // 本轮收包结束后要做的工作（TCP_DEFER_*）
+    uint8_t keepalive_probes;      // 已发送且尚未得到响应的保活探测数
+    tcp_ooo_seg_t *ooo_head;       // 按序列号排序的乱序数据
+
+    /* 温数据：首部预测的接收缓冲区检查、按序交付、接收缓冲区自动调整、延迟确认和定时器检查的字段，占其后两个缓存行 */
+    _Alignas(CACHE_LINE_SIZE) struct tcp_listener *listener;  // 端口上注册的处理程序，端口关闭时连接先被释放
+    uint64_t last_recv;       // 最近收到报文段的时间，用于空闲超时、保活和 FIN_WAIT2 超时
+    uint64_t delack_expire;   // 延迟确认定时器到期时间，0 表示未启动
+    uint64_t rto_expire;      // 重传定时器到期时间，0 表示未启动
+    uint8_t *rcv_buf;         // 接收缓冲区（环形），保存已按序到达、尚未被应用读取的数据，首次写入时分配
+    size_t rcv_size;          // 缓冲区容量，决定通告的窗口，按测得的 BDP 自动增大
+    size_t rcv_head;          // 最早未读数据在缓冲区中的位置
+    size_t rcv_len;           // 接收缓冲区中未读数据长度
+    uint64_t rcv_space_time;  // 本轮接收速率测量开始的时间，0 表示未开始
+    uint32_t rcv_space_seq;   // 本轮接收速率测量开始时的 ack
+    uint32_t srtt;            // 平滑 RTT（RFC 6298，毫秒），0 表示尚无测量值
+    uint32_t idle_timeout;    // 空闲超过该时间（毫秒）的连接被回收，0 表示不限
+    uint32_t keepalive;       // 空闲超过该时间（毫秒）后发送保活探测，0 表示不探测
+    uint32_t rcv_wup;         // 最近一次发送的确认号（RFC 1122 4.2.3.2）
+    uint32_t rcv_adv;         // 已通告的窗口右边界，窗口不会缩小
+    uint16_t rcv_mss;         // 对端满长度报文段的长度，即本端通告的 MSS
+
+    /* 冷数据：在握手时协商的选项（RFC 7323、RFC 2018） */
+    uint16_t mss;         // 对端在 SYN 中通告的最大报文段长度
+    uint8_t rcv_wscale;   // 本端通告窗口的扩大因子，对端不支持窗口扩大时为0
+    uint8_t sack_ok;      // 对端允许 SACK
+
+    /* TCP send buffer，保存已发送未确认和尚未发送的数据 */
+    uint32_t snd_sml;  // 最近发送的不足 MSS 的报文段的结束序列号（Nagle 算法）
+    uint8_t *snd_buf;  // 环形缓冲区，首次发送数据时分配
+    size_t snd_size;   // 缓冲区容量
+    size_t snd_head;   // 最早未确认的数据在缓冲区中的位置
+    size_t snd_len;    // 缓冲区中的数据长度
+
+    /* TCP retransmission timer（RFC 6298），单位为毫秒，srtt 在温数据中 */
+    uint32_t rttvar;      // RTT 偏差
+    uint32_t rto;         // 重传超时
+    uint32_t rtt_seq;     // 正在测量 RTT 的报文段的结束序列号
+    uint64_t rtt_start;   // 该报文段的发送时间，0 表示未在测量
+    uint8_t retries;      // 连续超时重传次数
+
+    /* TCP congestion control（RFC 5681、RFC 6582），单位为字节 */
+    const tcp_cc_ops_t *cc;                // 拥塞控制算法
+    uint32_t cwnd;                         // 拥塞窗口
+    uint32_t ssthresh;                     // 慢启动阈值
+    uint32_t recover;                      // 进入快速恢复时的 snd_max
+    uint16_t smss;                         // 发送 MSS
+    uint64_t cc_priv[TCP_CC_PRIV_SIZE];    // 拥塞控制算法的私有状态
+
+    /* TCP SACK scoreboard，按序列号排序且互不重叠 */
+    tcp_sack_block_t sacked[TCP_SACK_SCOREBOARD];  // 对端已 SACK 的数据
+    uint8_t sacked_num;
+    uint32_t rexmit_next;  // 快速恢复中下一个可以重传的序列号
 
-    /* TCP communication states */
-    int port;
-    uint32_t seq;  // 要发送的序列号
-    uint32_t ack;  // 要发送的 ACK
+    /* TCP out-of-order queue */
+    uint32_t ooo_bytes;  // 乱序队列中的数据总量
+
+    void *user;  // 应用关联到连接上的上下文，如套接字，协议栈不使用
 } tcp_conn_t;
 
+typedef struct tcp_timewait {  // TIME_WAIT 状态的连接只保留重新确认对端 FIN 所需的信息
+    struct tcp_timewait *hash_next;   // 同一哈希桶中的下一个表项，空闲时为空闲链表的下一个
+    struct tcp_timewait *timer_prev;  // 按到期时间排序的链表
+    struct tcp_timewait *timer_next;
+    tcp_key_t key;
+    uint64_t expire;     // 2MSL 结束的时间（毫秒）
+    uint32_t seq;        // 本端的下一个序列号
+    uint32_t ack;        // 期望的对端序列号
+    uint32_t ts_recent;  // 对端最近的时间戳
+    uint8_t ts_ok;       // 对端使用时间戳
+} tcp_timewait_t;
+
+typedef struct tcp_synrecv {  // 半连接只保留完成握手所需的信息，握手完成后才分配完整的连接
+    struct tcp_synrecv *hash_next;   // 同一哈希桶中的下一个表项，空闲时为空闲链表的下一个
+    struct tcp_synrecv *timer_prev;  // 重传次数相同的半连接按到期时间排序的链表
+    struct tcp_synrecv *timer_next;
+    tcp_key_t key;
+    uint32_t iss;        // 本端的初始序列号
+    uint32_t irs;        // 对端的初始序列号
+    uint32_t snd_wnd;    // 对端在 SYN 中通告的窗口
+    uint32_t ts_recent;  // 对端 SYN 中的时间戳
+    uint16_t mss;        // 对端通告的 MSS
+    uint8_t snd_wscale;  // 对端窗口的扩大因子，不支持时为 TCP_WSCALE_NONE
+    uint8_t sack_ok;     // 对端允许 SACK
+    uint8_t ts_ok;       // 对端使用时间戳
+    uint8_t retries;     // SYN-ACK 的重传次数
+    uint64_t sent;       // 首次发送 SYN-ACK 的时间（毫秒），用于测量 RTT
+    uint64_t expire;     // SYN-ACK 重传定时器到期时间
+} tcp_synrecv_t;
+
 #define TCP_FLG_URG (1 << 5)
 #define TCP_FLG_ACK (1 << 4)
 #define TCP_FLG_PSH (1 << 3)
@@ -57,18 +195,107 @@ typedef struct tcp_connection {
 
 #define TCP_FLG_ISSET(x, y) (((x & 0x3f) & (y)) ? 1 : 0)
 
+#define TCP_SEQ_LT(a, b) ((int32_t)((a) - (b)) < 0)  // 序列号比较，考虑回绕
+#define TCP_SEQ_LEQ(a, b) ((int32_t)((a) - (b)) <= 0)
+#define TCP_SEQ_GT(a, b) ((int32_t)((a) - (b)) > 0)
+#define TCP_SEQ_GEQ(a, b) ((int32_t)((a) - (b)) >= 0)
+
 #define TCP_HEADER_LEN 20
-#define TCP_RETRANSMISSON_TIMEOUT 3
+#define TCP_MAX_HEADER_LEN 60  // 首部长度字段为4bit，以4字节为单位
+
+#define TCP_OPT_END 0        // 选项列表结束
+#define TCP_OPT_NOP 1        // 填充
+#define TCP_OPT_MSS 2        // 最大报文段长度
+#define TCP_OPT_WS 3         // 窗口扩大因子（RFC 7323）
+#define TCP_OPT_SACK_PERM 4  // 允许 SACK（RFC 2018）
+#define TCP_OPT_SACK 5       // SACK 块
+#define TCP_OPT_TS 8         // 时间戳（RFC 7323）
+#define TCP_OPT_TS_LEN 12    // 时间戳选项加上对齐用的 NOP 的长度
+
+#define TCP_WSCALE 7          // 本端的窗口扩大因子
+#define TCP_MAX_WSCALE 14     // 窗口扩大因子上限（RFC 7323）
+#define TCP_WSCALE_NONE 0xff  // 对端未携带窗口扩大选项
+
+#define TCP_DEFAULT_MSS 536  // 对端未通告 MSS 时使用的默认值（RFC 1122）
+#define TCP_RETRANSMISSON_TIMEOUT 3  // 尚无 RTT 测量值时的初始重传超时（秒）
+#define TCP_MIN_RTO_MS 1000          // RTO 下限（RFC 6298）
+#define TCP_MAX_RTO_MS 60000         // 指数退避的 RTO 上限
+#define TCP_CLOCK_GRANULARITY_MS 1   // 时钟粒度 G
+#define TCP_MAX_RETRIES 8            // 连续超时重传次数上限，超过则放弃连接
+#define TCP_TIMER_TICK_MS 10         // 重传定时器的检查间隔
+#define TCP_DELACK_MS 40             // 延迟确认的最长时间（RFC 1122 要求不超过 500ms）
+#define TCP_MSL_SEC 30                       // 报文段在网络中的最长生存时间
+#define TCP_TIME_WAIT_SEC (2 * TCP_MSL_SEC)  // TIME_WAIT 持续 2MSL
+#define TCP_FIN_WAIT2_TIMEOUT_MS 60000       // FIN_WAIT2 状态下等待对端 FIN 的最长时间
+#define TCP_IDLE_TIMEOUT_MS (15 * 60 * 1000)  // 默认的空闲超时，崩溃的对端不会永久占用连接表
+#define TCP_KEEPALIVE_INTVL_MS 75000          // 保活探测的间隔
+#define TCP_KEEPALIVE_PROBES 9                // 连续无响应的保活探测数上限，超过则放弃连接
+#define TCP_DEFER_QUEUE_LEN NET_RX_BURST  // 一轮收包中最多推迟处理的连接数
+#define TCP_DEFER_ACK 0x1                 // 发送合并的 ACK
+#define TCP_DEFER_OUTPUT 0x2              // 发送 tcp_write() 写入的数据
+
+#define TCP_CONGESTION_CONTROL "cubic"  // 默认拥塞控制算法
+#define TCP_DUPACK_THRESHOLD 3           // 触发快速重传的重复 ACK 个数
+
+#define TCP_SEND_BUFFER_SIZE (64 * 1024)            // 发送缓冲区初始容量
+#define TCP_SEND_BUFFER_MAX_SIZE (4 * 1024 * 1024)  // 发送缓冲区容量上限，按需倍增
+#define TCP_RECV_BUFFER_SIZE (256 * 1024)           // 接收缓冲区初始容量
+#define TCP_RECV_BUFFER_MAX_SIZE (4 * 1024 * 1024)  // 接收缓冲区自动调整的上限
+#define TCP_RCVBUF_RTT_MS 100                       // 尚无 RTT 测量值时测量接收速率的周期
+#define TCP_SYN_BACKLOG 128       // 每个端口的半连接数上限，超过后以 SYN cookie 应答
+#define TCP_SYN_RETRIES 5         // SYN-ACK 的最大重传次数
+#define TCP_COOKIE_PERIOD_SEC 64  // SYN cookie 中计数器的递增周期
+#define TCP_COOKIE_MAX_AGE 2      // SYN cookie 的有效期（以计数器周期计）
+#define TCP_EPHEMERAL_PORT_MIN 49152  // 主动打开连接使用的临时端口范围（RFC 6335）
+#define TCP_EPHEMERAL_PORT_MAX 65535
 #define TCP_MAX_WINDOW_SIZE UINT16_MAX
-#define TCP_MAX_CONN_NUM (MAP_MAX_LEN / (sizeof(tcp_key_t) + sizeof(tcp_conn_t) + sizeof(time_t)))
+#define TCP_CONN_CHUNK_NUM 1024  // 连接池每次扩充的连接数，TCP_MAX_CONN_NUM 须为其整数倍
+#define TCP_SYNRECV_MAX_NUM 1024 // 半连接池容量，用尽后以 SYN cookie 应答
+#define TCP_TIMEWAIT_MAX_NUM 4096 // TIME_WAIT 池容量，用尽后复用最早到期的表项
+#define TCP_TIMEWAIT_HASH_SIZE 4096 // TIME_WAIT 表的哈希桶数，须为2的幂
+
+#define TCP_EVENT_ACCEPT 0x1  // 被动打开的连接已建立
+#define TCP_EVENT_WRITE 0x2   // 发送缓冲区中的数据被确认，腾出了空间
+#define TCP_EVENT_CLOSE 0x4   // 连接即将释放，通知返回后连接指针不再有效
 
 typedef void (*tcp_handler_t)(tcp_conn_t *tcp_conn, uint8_t *data, size_t len, uint8_t *src_ip, uint16_t src_port);
+typedef void (*tcp_notify_t)(tcp_conn_t *tcp_conn, uint8_t events);
+
+typedef struct tcp_listener {  // 端口上注册的处理程序
+    tcp_handler_t handler;
+    tcp_notify_t notify;  // 连接建立、发送缓冲区腾出空间和连接释放的通知（TCP_EVENT_*），可以为NULL
+    uint8_t buffered;     // 数据先写入接收缓冲区，处理程序收到的 data 为NULL，len 为可读长度，通过 tcp_read() 读取
+    uint8_t active;       // 由 tcp_connect() 占用的临时端口，不接受连接请求，连接释放时一并移除
+    uint8_t closed;       // 已由 tcp_unlisten() 停止接受连接，端口在最后一个连接释放时一并关闭
+    uint32_t conn_num;    // 该端口上的连接数
+    uint16_t syn_queued;  // 该端口上的半连接数，不超过 TCP_SYN_BACKLOG
+    uint32_t idle_timeout;  // 新连接的空闲超时（毫秒），0 表示不限
+    uint32_t keepalive;     // 新连接开始保活探测前的空闲时间（毫秒），0 表示不探测
+} tcp_listener_t;
+
+extern const tcp_cc_ops_t tcp_cc_newreno;
+extern const tcp_cc_ops_t tcp_cc_cubic;
+const tcp_cc_ops_t *tcp_cc_find(const char *name);
+int tcp_set_congestion_control(tcp_conn_t *tcp_conn, const char *name);
 
 void tcp_init();
+void tcp_poll();
 int tcp_open(uint16_t port, tcp_handler_t handler);
+int tcp_open_buffered(uint16_t port, tcp_handler_t handler);
 void tcp_close(uint16_t port);
+void tcp_unlisten(uint16_t port);
+tcp_conn_t *tcp_connect(uint8_t *dst_ip, uint16_t dst_port, tcp_handler_t handler);
+tcp_conn_t *tcp_connect_buffered(uint8_t *dst_ip, uint16_t dst_port, tcp_handler_t handler);
+int tcp_set_idle_timeout(uint16_t port, uint32_t timeout_ms);
+int tcp_set_keepalive(uint16_t port, uint32_t idle_ms);
+int tcp_set_notify(uint16_t port, tcp_notify_t notify);
 
 void tcp_in(buf_t *buf, uint8_t *src_ip);
 void tcp_out(tcp_conn_t *tcp_conn, buf_t *buf, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port, uint8_t flags);
-void tcp_send(tcp_conn_t *tcp_conn, uint8_t *data, uint16_t len, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port);
+size_t tcp_send(tcp_conn_t *tcp_conn, uint8_t *data, size_t len, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port);
+size_t tcp_read(tcp_conn_t *tcp_conn, uint8_t *buf, size_t len);
+size_t tcp_write(tcp_conn_t *tcp_conn, const uint8_t *data, size_t len);
+void tcp_flush(tcp_conn_t *tcp_conn);
+void tcp_shutdown(tcp_conn_t *tcp_conn);
+void tcp_abort(tcp_conn_t *tcp_conn);
 #endif
\ No newline at end of file
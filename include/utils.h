@@ -15,5 +15,6 @@ uint16_t transport_checksum(uint8_t protocol, buf_t *buf, uint8_t *src_ip, uint8
 char *iptos(uint8_t *ip);
 char *mactos(uint8_t *mac);
 char *timetos(time_t timestamp);
+uint64_t time_now_ms();
 uint8_t ip_prefix_match(uint8_t *ipa, uint8_t *ipb);
 #endif
\ No newline at end of file
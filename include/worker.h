@@ -0,0 +1,27 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include "tcp.h"
+
+#define WORKER_MAX_NUM 64                             // 工作线程数上限
+#define WORKER_RING_SIZE 1024                         // 每个工作线程的接收队列容量，必须是2的幂
+#define WORKER_REPLY_RING_SIZE 4096                   // 工作线程发回协议栈的队列容量，必须是2的幂
+#define WORKER_MSG_MAX_LEN (16 * 1024)                // 分发给工作线程的一条消息最多携带的数据
+#define WORKER_SEND_BUFFER_SIZE TCP_SEND_BUFFER_SIZE  // 发送缓冲区中的数据达到该值时，后续响应留在连接的队列中
+
+/**
+ * @brief 工作线程中运行的应用回调，同一连接的数据总是按顺序交给同一个工作线程
+ *
+ * @param conn  连接句柄，用于 worker_send() 和 worker_shutdown()，连接释放后失效
+ * @param data  收到的数据
+ * @param len   数据长度，为0表示对端已关闭
+ */
+typedef void (*worker_handler_t)(uint32_t conn, const uint8_t *data, size_t len);
+
+int worker_init(int num);
+int worker_open(uint16_t port, worker_handler_t handler);
+void worker_poll();
+void worker_exit();
+int worker_send(uint32_t conn, const void *data, size_t len);
+int worker_shutdown(uint32_t conn);
+#endif
@@ -14,8 +14,6 @@ static const arp_pkt_t arp_init_pkt = {
     .pro_type16 = swap16(NET_PROTOCOL_IP),
     .hw_len = NET_MAC_LEN,
     .pro_len = NET_IP_LEN,
-    .sender_ip = NET_IF_IP,
-    .sender_mac = NET_IF_MAC,
     .target_mac = {0}};
 
 /**
@@ -54,12 +52,15 @@ void arp_print() {
 /**
  * @brief 发送一个arp请求
  *
+ * @param netif 发出请求的网卡
  * @param target_ip 想要知道的目标的ip地址
  */
-void arp_req(uint8_t *target_ip) {
+void arp_req(net_if_t *netif, uint8_t *target_ip) {
 //调用 buf_init() 函数对 txbuf 进行初始化。
 // 初始化为0长度，然后通过 buf_add_header 分配 arp 头部空间，避免重复计数
 buf_init(&txbuf, 0);
+//从指定网卡发出，发送方地址使用该网卡的地址。
+txbuf.netif = netif;
 //调用 buf_add_header() 函数为 txbuf 添加 ARP 报头空间。
 buf_add_header(&txbuf, sizeof(arp_pkt_t));
 //将 arp_init_pkt 复制到 txbuf 中，作为 ARP 报文的初始内容。
@@ -67,6 +68,8 @@ arp_pkt_t *arpHeader = (arp_pkt_t *)txbuf.data;
 memcpy(arpHeader, &arp_init_pkt, sizeof(arp_pkt_t));
 //按照 ARP 协议规范，准确填写 ARP 报头信息。
 arpHeader->opcode16 = swap16(ARP_REQUEST);
+memcpy(arpHeader->sender_ip, txbuf.netif->ip, NET_IP_LEN);
+memcpy(arpHeader->sender_mac, txbuf.netif->mac, NET_MAC_LEN);
 memcpy(arpHeader->target_ip, target_ip, NET_IP_LEN);
 //调用 ethernet_out 函数将 ARP 报文发送出去。需要注意的是，ARP announcement 或 ARP 请求报文均为广播报文，其目标 MAC 地址应设置为广播地址：FF - FF - FF - FF - FF - FF。
 ethernet_out(&txbuf, (uint8_t *)ether_broadcast_mac, NET_PROTOCOL_ARP);
@@ -75,12 +78,14 @@ ethernet_out(&txbuf, (uint8_t *)ether_broadcast_mac, NET_PROTOCOL_ARP);
 /**
  * @brief 发送一个arp响应
  *
+ * @param netif 收到请求的网卡，响应从该网卡发出并使用其地址
  * @param target_ip 目标ip地址
  * @param target_mac 目标mac地址
  */
-void arp_resp(uint8_t *target_ip, uint8_t *target_mac) {
+void arp_resp(net_if_t *netif, uint8_t *target_ip, uint8_t *target_mac) {
     //Step1. 初始化缓冲区：调用 buf_init() 函数初始化 txbuf。
     buf_init(&txbuf, 0);
+    txbuf.netif = netif;
     //Step1.5. 添加 ARP 报头空间：调用 buf_add_header() 函数为 txbuf 添加 ARP 报头空间。
     buf_add_header(&txbuf, sizeof(arp_pkt_t));
     //Step1.75. 复制初始内容：将 arp_init_pkt 复制到 txbuf 中，作为 ARP 报文的初始内容。
@@ -88,6 +93,8 @@ void arp_resp(uint8_t *target_ip, uint8_t *target_mac) {
     memcpy(arpHeader, &arp_init_pkt, sizeof(arp_pkt_t));
     //Step2. 填写 ARP 报头首部：按照 ARP 协议规范，准确填写 ARP 报头首部信息。
     arpHeader->opcode16 = swap16(ARP_REPLY);
+    memcpy(arpHeader->sender_ip, txbuf.netif->ip, NET_IP_LEN);
+    memcpy(arpHeader->sender_mac, txbuf.netif->mac, NET_MAC_LEN);
     memcpy(arpHeader->target_ip, target_ip, NET_IP_LEN);
     memcpy(arpHeader->target_mac, target_mac, NET_MAC_LEN);
     //Step3. 发送 ARP 报文：调用 ethernet_out() 函数将填充好的 ARP 报文发送出去。
@@ -132,8 +139,8 @@ void arp_in(buf_t *buf, uint8_t *src_mac) {
         map_delete(&arp_buf, sender_ip);
     } else {
         if (swap16(arpHeader->opcode16) == ARP_REQUEST &&
-            memcmp(target_ip, net_if_ip, NET_IP_LEN) == 0) {
-            arp_resp(sender_ip, sender_mac);
+            memcmp(target_ip, buf->netif->ip, NET_IP_LEN) == 0) {
+            arp_resp(buf->netif, sender_ip, sender_mac);
             }
         }
 }
@@ -158,7 +165,7 @@ void arp_out(buf_t *buf, uint8_t *ip) {
     //Step3. 未找到对应 MAC 地址：若未找到对应的 MAC 地址，需进一步判断 arp_buf 中是否已经有包。若有包，说明正在等待该 IP 回应 ARP 请求，此时不能再发送 ARP 请求；若没有包，则调用 map_set() 函数将来自 IP 层的数据包缓存到 arp_buf 中，然后调用 arp_req() 函数，发送一个请求目标 IP 地址对应的 MAC 地址的 ARP request 报文。
     if(map_get(&arp_buf,ip)==NULL){
         map_set(&arp_buf,ip,buf);
-        arp_req(ip);
+        arp_req(buf->netif, ip);
     }
 }
 
@@ -170,5 +177,6 @@ void arp_init() {
     map_init(&arp_table, NET_IP_LEN, NET_MAC_LEN, 0, ARP_TIMEOUT_SEC, NULL, NULL);
     map_init(&arp_buf, NET_IP_LEN, sizeof(buf_t), 0, ARP_MIN_INTERVAL, NULL, buf_copy);
     net_add_protocol(NET_PROTOCOL_ARP, arp_in);
-    arp_req(net_if_ip);
+    for (size_t i = 0; i < net_if_num; i++)  // 免费arp从拥有该地址的网卡发出
+        arp_req(&net_if_list[i], net_if_list[i].ip);
 }
\ No newline at end of file
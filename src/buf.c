@@ -99,4 +99,5 @@ void buf_copy(void *pdst, const void *psrc, size_t len) {
     const buf_t *src = psrc;
     buf_init(dst, src->len);
     memcpy(dst->payload, src->payload, BUF_MAX_LEN);
+    dst->netif = src->netif;
 }
@@ -0,0 +1,369 @@
+#include "coro.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <ucontext.h>
+#endif
+
+typedef enum coro_state {
+    CORO_STATE_FREE,     // 空闲，栈留在池中
+    CORO_STATE_READY,    // 在运行队列中
+    CORO_STATE_RUNNING,  // 正在运行
+    CORO_STATE_WAITING,  // 等待套接字就绪
+} coro_state_t;
+
+typedef struct coro {
+    coro_state_t state;
+    coro_fn_t fn;
+    void *arg;
+    int next;  // 运行队列或空闲链表的下一个
+    int wait_errno;  // 等待期间套接字被 coro_close() 关闭时为 EBADF
+#ifdef _WIN32
+    void *fiber;
+#else
+    ucontext_t ctx;
+    void *stack;
+#endif
+} coro_t;
+
+/**
+ * @brief 协程表及其空闲链表。协程的上下文和栈在结束后不释放，
+ *        入口函数循环执行新分配的任务，创建协程不需要重新分配栈
+ *
+ */
+static coro_t coro_table[CORO_MAX_NUM];
+static int coro_free;
+static int coro_used;  // 从未分配过的协程从该编号开始，协程表只在用到时才被访问
+/**
+ * @brief 运行队列，通过 next 串成先进先出队列
+ *
+ */
+static int coro_run_head;
+static int coro_run_tail;
+/**
+ * @brief 当前运行的协程，在调度器中为NULL
+ *
+ */
+static coro_t *coro_current;
+/**
+ * @brief 等待套接字就绪的协程，一个套接字同时只能被一个协程等待
+ *
+ */
+static int coro_waiter[SOCK_MAX_NUM];
+static int coro_poller;
+
+#ifdef _WIN32
+static void *coro_sched_fiber;
+#else
+static ucontext_t coro_sched_ctx;
+#endif
+
+/**
+ * @brief 把协程加入运行队列的队尾
+ *
+ * @param id    协程编号
+ */
+static void coro_ready(int id) {
+    coro_table[id].state = CORO_STATE_READY;
+    coro_table[id].next = -1;
+    if (coro_run_tail >= 0)
+        coro_table[coro_run_tail].next = id;
+    else
+        coro_run_head = id;
+    coro_run_tail = id;
+}
+
+/**
+ * @brief 从协程切换回调度器
+ *
+ * @param co    当前协程
+ */
+static void coro_switch_out(coro_t *co) {
+#ifdef _WIN32
+    SwitchToFiber(coro_sched_fiber);
+#else
+    swapcontext(&co->ctx, &coro_sched_ctx);
+#endif
+}
+
+/**
+ * @brief 协程入口，执行完一个任务后回到调度器，再次被分配时继续执行下一个任务
+ *
+ */
+#ifdef _WIN32
+static VOID CALLBACK coro_main(LPVOID param) {
+    coro_t *co = param;
+#else
+static void coro_main() {
+    coro_t *co = coro_current;
+#endif
+    for (;;) {
+        co->fn(co->arg);
+        co->state = CORO_STATE_FREE;
+        coro_switch_out(co);
+    }
+}
+
+/**
+ * @brief 从调度器切换到协程，协程让出或结束后返回
+ *
+ * @param id    协程编号
+ */
+static void coro_resume(int id) {
+    coro_t *co = &coro_table[id];
+    co->state = CORO_STATE_RUNNING;
+    coro_current = co;
+#ifdef _WIN32
+    SwitchToFiber(co->fiber);
+#else
+    swapcontext(&coro_sched_ctx, &co->ctx);
+#endif
+    coro_current = NULL;
+    if (co->state == CORO_STATE_FREE) {  // 任务已结束，回收协程
+        co->fn = NULL;
+        co->arg = NULL;
+        co->next = coro_free;
+        coro_free = id;
+    }
+}
+
+/**
+ * @brief 初始化协程调度器，需在 sock_init 之后调用
+ *
+ * @return int  成功为0，失败为-1
+ */
+int coro_init() {
+#ifdef _WIN32
+    coro_sched_fiber = ConvertThreadToFiber(NULL);
+    if (coro_sched_fiber == NULL)
+        return -1;
+#endif
+    coro_poller = sock_poller_create();
+    if (coro_poller < 0)
+        return -1;
+    coro_free = -1;
+    coro_used = 0;
+    coro_run_head = coro_run_tail = -1;
+    coro_current = NULL;
+    for (int fd = 0; fd < SOCK_MAX_NUM; fd++)
+        coro_waiter[fd] = -1;
+    return 0;
+}
+
+/**
+ * @brief 创建一个协程，在调度器的下一轮开始运行
+ *
+ * @param fn    协程执行的函数，返回即结束
+ * @param arg   传给 fn 的参数
+ * @return int  成功为0，协程表已满或无法分配栈时为-1
+ */
+int coro_spawn(coro_fn_t fn, void *arg) {
+    int id = coro_free >= 0 ? coro_free : coro_used;
+    if (id == CORO_MAX_NUM) {
+        errno = EAGAIN;
+        return -1;
+    }
+    coro_t *co = &coro_table[id];
+#ifdef _WIN32
+    if (co->fiber == NULL && (co->fiber = CreateFiber(CORO_STACK_SIZE, coro_main, co)) == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+#else
+    if (co->stack == NULL) {  // 首次使用，分配栈并让上下文从入口函数开始
+        co->stack = malloc(CORO_STACK_SIZE);
+        if (co->stack == NULL) {
+            errno = ENOMEM;
+            return -1;
+        }
+        getcontext(&co->ctx);
+        co->ctx.uc_stack.ss_sp = co->stack;
+        co->ctx.uc_stack.ss_size = CORO_STACK_SIZE;
+        co->ctx.uc_link = NULL;  // 入口函数不会返回
+        makecontext(&co->ctx, coro_main, 0);
+    }
+#endif
+    if (id == coro_free)
+        coro_free = co->next;
+    else
+        coro_used++;
+    co->fn = fn;
+    co->arg = arg;
+    co->wait_errno = 0;
+    coro_ready(id);
+    return 0;
+}
+
+/**
+ * @brief 让出执行权，协议栈轮询一次后继续执行。在协程之外调用时不做任何事
+ *
+ */
+void coro_yield() {
+    coro_t *co = coro_current;
+    if (co == NULL)
+        return;
+    coro_ready(co - coro_table);
+    coro_switch_out(co);
+}
+
+/**
+ * @brief 挂起当前协程，直到套接字上发生关注的事件或连接被释放
+ *
+ * @param fd        套接字描述符
+ * @param events    关注的事件（SOCK_POLLIN、SOCK_POLLOUT）
+ * @return int      成功为0，失败为-1，等待期间套接字被关闭时 errno 为 EBADF
+ */
+int coro_wait(int fd, uint32_t events) {
+    coro_t *co = coro_current;
+    if (co == NULL) {  // 调度器不能挂起
+        errno = EPERM;
+        return -1;
+    }
+    if (fd < 0 || fd >= SOCK_MAX_NUM) {
+        errno = EBADF;
+        return -1;
+    }
+    if (coro_waiter[fd] >= 0) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (sock_poller_ctl(coro_poller, SOCK_CTL_ADD, fd, events) < 0)
+        return -1;
+    coro_waiter[fd] = co - coro_table;
+    co->state = CORO_STATE_WAITING;
+    coro_switch_out(co);
+    if (co->wait_errno) {  // 由 coro_close() 唤醒
+        errno = co->wait_errno;
+        co->wait_errno = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 关闭套接字，等待该套接字的协程被唤醒，其 coro_wait() 返回-1且 errno 为 EBADF。
+ *        协程程序应使用它代替 sock_close()，否则等待者永远不会被唤醒
+ *
+ * @param fd    套接字描述符
+ * @return int  成功为0，失败为-1
+ */
+int coro_close(int fd) {
+    if (fd >= 0 && fd < SOCK_MAX_NUM && coro_waiter[fd] >= 0) {
+        int id = coro_waiter[fd];
+        coro_waiter[fd] = -1;
+        sock_poller_ctl(coro_poller, SOCK_CTL_DEL, fd, 0);
+        coro_table[id].wait_errno = EBADF;
+        coro_ready(id);
+    }
+    return sock_close(fd);
+}
+
+/**
+ * @brief 接受一个连接，没有等待接受的连接时挂起当前协程
+ *
+ * @param fd        监听套接字
+ * @param src_ip    对端 IP 地址，可以为NULL
+ * @param src_port  对端端口号，可以为NULL
+ * @return int      新连接的套接字描述符，失败为-1
+ */
+int coro_accept(int fd, uint8_t *src_ip, uint16_t *src_port) {
+    for (;;) {
+        int cfd = sock_accept(fd, src_ip, src_port);
+        if (cfd >= 0 || errno != EAGAIN)
+            return cfd;
+        if (coro_wait(fd, SOCK_POLLIN) < 0)
+            return -1;
+    }
+}
+
+/**
+ * @brief 从连接读取数据，暂无数据时挂起当前协程
+ *
+ * @param fd        套接字描述符
+ * @param buf       目标地址
+ * @param len       最多读取的长度
+ * @return ssize_t  读取的长度，对端已关闭且数据读完时为0，失败为-1
+ */
+ssize_t coro_read(int fd, void *buf, size_t len) {
+    for (;;) {
+        ssize_t n = sock_read(fd, buf, len);
+        if (n >= 0 || errno != EAGAIN)
+            return n;
+        if (coro_wait(fd, SOCK_POLLIN) < 0)
+            return -1;
+    }
+}
+
+/**
+ * @brief 向连接写入全部数据，发送缓冲区已满时挂起当前协程，直到对端确认腾出空间
+ *
+ * @param fd        套接字描述符
+ * @param buf       要发送的数据
+ * @param len       数据长度
+ * @return ssize_t  写入的长度，即 len；连接已关闭时为-1
+ */
+ssize_t coro_write(int fd, const void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = sock_write(fd, (const uint8_t *)buf + done, len - done);
+        if (n >= 0) {
+            done += n;
+            continue;
+        }
+        if (errno != EAGAIN || coro_wait(fd, SOCK_POLLOUT) < 0)
+            return -1;
+    }
+    return done;
+}
+
+/**
+ * @brief 读取文件，读完一块后让出执行权，使大文件的读取与其他连接的收发交替进行
+ *
+ * @param buf       目标地址
+ * @param len       最多读取的长度
+ * @param file      文件
+ * @return size_t   读取的长度，文件尾或出错时为0
+ */
+size_t coro_file_read(void *buf, size_t len, FILE *file) {
+    size_t n = fread(buf, 1, len, file);
+    coro_yield();
+    return n;
+}
+
+/**
+ * @brief 调度器主循环，代替 net_poll 的主循环，不返回。每轮轮询一次协议栈，
+ *        唤醒套接字已就绪的协程，再运行本轮开始前已在运行队列中的协程
+ *
+ */
+void coro_run() {
+    sock_event_t events[CORO_MAX_EVENTS];
+    for (;;) {
+        // 有可运行的协程时只轮询一次，否则一直等待到有套接字就绪
+        int n = sock_poller_wait(coro_poller, events, CORO_MAX_EVENTS, coro_run_head >= 0 ? 0 : -1);
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].fd;
+            int id = coro_waiter[fd];
+            if (id < 0)
+                continue;
+            coro_waiter[fd] = -1;
+            sock_poller_ctl(coro_poller, SOCK_CTL_DEL, fd, 0);
+            coro_ready(id);
+        }
+        // 本轮中让出的协程排到队尾，下一轮再运行，其间协议栈可以收发
+        int last = coro_run_tail;
+        while (coro_run_head >= 0) {
+            int id = coro_run_head;
+            coro_run_head = coro_table[id].next;
+            if (coro_run_head < 0)
+                coro_run_tail = -1;
+            coro_resume(id);
+            if (id == last)
+                break;
+        }
+    }
+}
@@ -1,5 +1,11 @@
 #include "driver.h"
 
+#include "ethernet.h"
+#include "ip.h"
+
+#include <stdarg.h>
+#include <sys/time.h>
+
 #include <pcap.h>
 
 #ifdef _WIN32
@@ -26,7 +32,6 @@ BOOL LoadNpcapDlls() {
 }
 #endif
 
-pcap_t *pcap;
 char pcap_errbuf[PCAP_ERRBUF_SIZE];
 
 /**
@@ -74,7 +79,7 @@ int driver_find(uint8_t *ip, char *if_name, uint8_t *mask) {
     for (d = alldevs, i = 0; i < max_if; d = d->next, i++)
         ;
     if (max_match == 32) {
-        fprintf(stderr, "Error, interface %s have the same ip %s with me.\n", d->name, iptos(net_if_ip));
+        fprintf(stderr, "Error, interface %s have the same ip %s with me.\n", d->name, iptos(ip));
         return -1;
     }
     for (a = d->addresses; a; a = a->next)
@@ -85,12 +90,142 @@ int driver_find(uint8_t *ip, char *if_name, uint8_t *mask) {
     return 0;
 }
 
+/**
+ * @brief 生成过滤表达式时的写入位置，供map_foreach的回调函数使用
+ *
+ */
+static char *filter_pos, *filter_end;
+static uint16_t filter_protocol;
+static size_t filter_port_num;
+
+/**
+ * @brief 向过滤表达式中追加内容，空间不足时将filter_pos置为filter_end
+ *
+ * @param fmt 格式字符串
+ * @param ... 格式参数
+ */
+static void driver_filter_append(const char *fmt, ...) {
+    if (filter_pos >= filter_end)
+        return;
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(filter_pos, filter_end - filter_pos, fmt, args);
+    va_end(args);
+    filter_pos = (len < 0 || len >= filter_end - filter_pos) ? filter_end : filter_pos + len;
+}
+
+/**
+ * @brief 将打开的端口逐个追加到过滤表达式中，同一协议的端口共用限定词
+ *
+ */
+static void driver_filter_port_fn(void *key, void *value, time_t *timestamp) {
+    net_port_t *port = key;
+    if (port->protocol != filter_protocol || port->port_last != port->port)
+        return;
+    if (filter_port_num++)
+        driver_filter_append(" or %u", port->port);
+    else
+        driver_filter_append(" or (%s dst port %u", port->protocol == NET_PROTOCOL_TCP ? "tcp" : "udp", port->port);
+}
+
+/**
+ * @brief 将打开的端口范围逐个追加到过滤表达式中，每个范围带完整的限定词
+ *
+ */
+static void driver_filter_port_range_fn(void *key, void *value, time_t *timestamp) {
+    net_port_t *port = key;
+    if (port->protocol != filter_protocol || port->port_last == port->port)
+        return;
+    driver_filter_append(" or (%s dst portrange %u-%u)", port->protocol == NET_PROTOCOL_TCP ? "tcp" : "udp", port->port, port->port_last);
+}
+
+/**
+ * @brief 追加网卡地址对应的过滤条件：发给本机的ARP，以及发给本机且协议栈会处理的IP包
+ *
+ * @param netif 网卡，VLAN子网卡在调用前已写入vlan限定，偏移由libpcap自动调整
+ */
+static void driver_filter_netif(net_if_t *netif) {
+    uint8_t *ip = netif->ip;
+    driver_filter_append("(arp and arp[24:4] = 0x%02x%02x%02x%02x) or (ip dst host %s and (",
+                         ip[0], ip[1], ip[2], ip[3], iptos(ip));
+    driver_filter_append("(ip[6:2] & 0x%x != 0)", IP_FRAGMENT_OFFSET);  // 非首分片不含传输层头部，交给ip层重组
+#ifdef ICMP
+    driver_filter_append(" or icmp");
+#endif
+    uint16_t protocols[] = {NET_PROTOCOL_UDP, NET_PROTOCOL_TCP};
+    for (size_t i = 0; i < sizeof(protocols) / sizeof(protocols[0]); i++) {
+        if (protocols[i] == 0xff)  // 未启用的协议
+            continue;
+        filter_protocol = protocols[i];
+        filter_port_num = 0;
+        map_foreach(&net_port_table, driver_filter_port_fn);
+        if (filter_port_num)
+            driver_filter_append(")");
+        map_foreach(&net_port_table, driver_filter_port_range_fn);
+    }
+    driver_filter_append("))");
+}
+
+/**
+ * @brief 根据网卡及其VLAN子网卡的地址和协议栈打开的端口生成包过滤器，让内核丢弃协议栈不会处理的包
+ *
+ * @param netif 物理网卡
+ * @return int 成功为0，失败为-1
+ */
+int driver_set_filter(net_if_t *netif) {
+    pcap_t *pcap = netif->driver;
+    static char filter_exp[DRIVER_FILTER_MAX_LEN];
+    struct bpf_program fp;
+    uint8_t *mac = netif->mac;
+    filter_pos = filter_exp;
+    filter_end = filter_exp + sizeof(filter_exp);
+    driver_filter_append("(ether dst %02x:%02x:%02x:%02x:%02x:%02x or ether broadcast) and (not ether src %02x:%02x:%02x:%02x:%02x:%02x)",
+                         mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+                         mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    size_t mac_len = filter_pos - filter_exp;
+
+    driver_filter_append(" and ((");
+    driver_filter_netif(netif);
+    driver_filter_append(")");
+    // vlan关键字会改变其后所有条件的偏移，因此只出现一次并放在最后，用ether[14:2]区分VLAN号
+    size_t vlan_num = 0;
+    for (size_t i = 0; i < net_if_num; i++) {
+        net_if_t *sub = &net_if_list[i];
+        if (sub->parent != netif)
+            continue;
+        driver_filter_append(vlan_num++ ? " or " : " or (vlan and (");
+        driver_filter_append("(ether[14:2] & 0x%x = %u and (", ETHERNET_VLAN_ID_MASK, sub->vlan_id);
+        driver_filter_netif(sub);
+        driver_filter_append("))");
+    }
+    if (vlan_num)
+        driver_filter_append("))");
+    driver_filter_append(")");
+
+    if (filter_pos >= filter_end) {  // 打开的端口过多，退化为只按mac过滤
+        fprintf(stderr, "Warning, filter expression too long, fall back to mac filter.\n");
+        filter_exp[mac_len] = '\0';
+    }
+    if (pcap_compile(pcap, &fp, filter_exp, 1, PCAP_NETMASK_UNKNOWN) < 0) {
+        fprintf(stderr, "Error in pcap_compile.\n%s.\n", pcap_geterr(pcap));
+        return -1;
+    }
+    if (pcap_setfilter(pcap, &fp) < 0) {
+        fprintf(stderr, "Error in pcap_setfilter.\n%s.\n", pcap_geterr(pcap));
+        pcap_freecode(&fp);
+        return -1;
+    }
+    pcap_freecode(&fp);
+    return 0;
+}
+
 /**
  * @brief 打开网卡
  *
+ * @param netif 要打开的网卡，根据其ip地址选取物理网卡
  * @return int 成功为0，失败为-1
  */
-int driver_open() {
+int driver_open(net_if_t *netif) {
 #ifdef _WIN32
     /* Load Npcap and its functions. */
     if (!LoadNpcapDlls()) {
@@ -101,76 +236,157 @@ int driver_open() {
 
     char if_name[PCAP_BUF_SIZE];
     uint32_t mask;
-    if (driver_find(net_if_ip, if_name, (uint8_t *)&mask) < 0) {
+    pcap_t *pcap;
+    if (driver_find(netif->ip, if_name, (uint8_t *)&mask) < 0) {
         fprintf(stderr, "Error in driver find.\n");
         return -1;
     }
-    printf("Using interface %s, my ip is %s.\n", if_name, iptos(net_if_ip));
+    printf("Using interface %s, my ip is %s.\n", if_name, iptos(netif->ip));
 
-    if ((pcap = pcap_open_live(if_name, 65536, 1, 10, pcap_errbuf)) == NULL)  // 混杂模式打开网卡
-    {
-        fprintf(stderr, "Error in pcap_open_live.\n%s.\n", pcap_errbuf);
+    pcap = pcap_create(if_name, pcap_errbuf);
+    if (pcap == NULL) {
+        fprintf(stderr, "Error in pcap_create.\n%s.\n", pcap_errbuf);
+        return -1;
+    }
+    netif->driver = pcap;
+    memset(&netif->stats, 0, sizeof(net_if_stats_t));
+    net_if_capture_t *cap = &netif->capture;
+    int snaplen = netif->mtu + sizeof(ether_hdr_t) + sizeof(vlan_hdr_t);  // 抓包长度随MTU变化，预留802.1Q标签
+    if (pcap_set_snaplen(pcap, snaplen) < 0 ||
+        pcap_set_promisc(pcap, 1) < 0 ||  // 混杂模式打开网卡
+        pcap_set_timeout(pcap, cap->timeout) < 0 ||
+        pcap_set_immediate_mode(pcap, cap->immediate) < 0 ||  // 即时模式下内核不再攒批，收到即唤醒
+        pcap_set_buffer_size(pcap, cap->buffer_size) < 0) {
+        fprintf(stderr, "Error in pcap_set config.\n%s.\n", pcap_geterr(pcap));
+        driver_close(netif);
         return -1;
     }
+    int ret = pcap_activate(pcap);
+    if (ret < 0) {
+        fprintf(stderr, "Error in pcap_activate. %s: %s.\n", pcap_statustostr(ret), pcap_geterr(pcap));
+        driver_close(netif);
+        return -1;
+    } else if (ret > 0)
+        fprintf(stderr, "Warning in pcap_activate. %s.\n", pcap_statustostr(ret));
+    printf("Capture mode: %s, timeout %d ms, buffer %d bytes.\n",
+           cap->immediate ? "immediate" : "batched", cap->timeout, cap->buffer_size);
     if (pcap_setnonblock(pcap, 1, pcap_errbuf) < 0)  // 设置非阻塞模式
     {
         fprintf(stderr, "Error in pcap_setnonblock. %s.\n", pcap_errbuf);
+        driver_close(netif);
         return -1;
     }
-    char filter_exp[PCAP_BUF_SIZE];
-    struct bpf_program fp;
-    uint8_t mac_addr[6] = NET_IF_MAC;
-    sprintf(filter_exp,  // 过滤数据包
-            "(ether dst %02x:%02x:%02x:%02x:%02x:%02x or ether broadcast) and (not ether src %02x:%02x:%02x:%02x:%02x:%02x)",
-            mac_addr[0],
-            mac_addr[1],
-            mac_addr[2],
-            mac_addr[3],
-            mac_addr[4],
-            mac_addr[5],
-            mac_addr[0],
-            mac_addr[1],
-            mac_addr[2],
-            mac_addr[3],
-            mac_addr[4],
-            mac_addr[5]);
-    if (pcap_compile(pcap, &fp, filter_exp, 0, mask) < 0) {
-        fprintf(stderr, "Error in pcap_compile.\n%s.\n", pcap_geterr(pcap));
+    if (driver_set_filter(netif) == -1) {
+        driver_close(netif);
         return -1;
     }
-    if (pcap_setfilter(pcap, &fp) < 0) {
-        fprintf(stderr, "Error in pcap_setfilter.\n%s.\n", pcap_geterr(pcap));
+    return 0;
+}
+/**
+ * @brief 记录数据包从内核抓取到用户态收到的时延
+ *
+ * @param netif 接收的网卡
+ * @param ts 内核抓包时间戳
+ */
+static void driver_record_latency(net_if_t *netif, const struct timeval *ts) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int64_t latency = (int64_t)(now.tv_sec - ts->tv_sec) * 1000000 + (now.tv_usec - ts->tv_usec);
+    if (latency < 0)  // 时钟被调整
+        latency = 0;
+    net_if_stats_t *stats = &netif->stats;
+    stats->rx_packets++;
+    stats->latency_sum += latency;
+    if ((uint64_t)latency > stats->latency_max)
+        stats->latency_max = latency;
+    size_t bucket = 0;
+    for (int64_t bound = 100; bucket < NET_IF_LATENCY_BUCKETS - 1 && latency >= bound; bound *= 10)
+        bucket++;
+    stats->latency_hist[bucket]++;
+}
+
+/**
+ * @brief 查询网卡的抓包统计并记录到网卡统计信息中
+ *
+ * @param netif 物理网卡
+ * @return int 自上次查询以来新增的丢包数，失败为-1
+ */
+int driver_stats(net_if_t *netif) {
+    pcap_t *pcap = netif->driver;
+    if (pcap == NULL)
+        return -1;
+    struct pcap_stat ps;
+    if (pcap_stats(pcap, &ps) < 0) {
+        fprintf(stderr, "Error in pcap_stats.\n%s.\n", pcap_geterr(pcap));
         return -1;
     }
-    return 0;
+    net_if_stats_t *stats = &netif->stats;
+    uint32_t drops = (ps.ps_drop - stats->ps_drop) + (ps.ps_ifdrop - stats->ps_ifdrop);  // 计数器回绕时无符号减法仍正确
+    stats->ps_recv = ps.ps_recv;
+    stats->ps_drop = ps.ps_drop;
+    stats->ps_ifdrop = ps.ps_ifdrop;
+    return drops > INT32_MAX ? INT32_MAX : (int)drops;
 }
+
+/**
+ * @brief 打印网卡的抓包统计及当前抓包模式下的时延分布
+ *
+ * @param netif 物理网卡
+ */
+void driver_print_stats(net_if_t *netif) {
+    net_if_stats_t *stats = &netif->stats;
+    printf("Interface %u (%s mode): kernel recv %u, drop %u, ifdrop %u, rx budget %u, buffer %d bytes\n",
+           netif->index, netif->capture.immediate ? "immediate" : "batched",
+           stats->ps_recv, stats->ps_drop, stats->ps_ifdrop, netif->rx_budget, netif->capture.buffer_size);
+    if (stats->rx_packets == 0)
+        return;
+    printf("  %llu packets, latency avg %llu us, max %llu us\n", (unsigned long long)stats->rx_packets,
+           (unsigned long long)(stats->latency_sum / stats->rx_packets), (unsigned long long)stats->latency_max);
+    static const char *bucket_name[NET_IF_LATENCY_BUCKETS] = {"<100us", "<1ms", "<10ms", ">=10ms"};
+    for (size_t i = 0; i < NET_IF_LATENCY_BUCKETS; i++)
+        printf("  %-7s %llu\n", bucket_name[i], (unsigned long long)stats->latency_hist[i]);
+}
+
 /**
  * @brief 试图从网卡接收数据包
  *
- * @param buf 收到的数据包
+ * @param netif 接收的网卡
+ * @param buf 收到的数据包，记录入口网卡
  * @return int 数据包的长度，未收到为0，错误为-1
  */
-int driver_recv(buf_t *buf) {
+int driver_recv(net_if_t *netif, buf_t *buf) {
+    pcap_t *pcap = netif->driver;
     struct pcap_pkthdr *pkt_hdr;
     const uint8_t *pkt_data;
-    int ret = pcap_next_ex(pcap, &pkt_hdr, &pkt_data);
-    if (ret == 0)
-        return 0;
-    else if (ret == 1) {
+    int ret;
+    while ((ret = pcap_next_ex(pcap, &pkt_hdr, &pkt_data)) == 1) {
+        if (pkt_hdr->caplen < pkt_hdr->len)  // 超过MTU的帧被截断，丢弃后继续读取下一帧
+            continue;
         memcpy(buf->data, pkt_data, pkt_hdr->len);
         buf->len = pkt_hdr->len;
+        buf->netif = netif;
+        if (netif->capture.report)
+            driver_record_latency(netif, &pkt_hdr->ts);
         return pkt_hdr->len;
     }
+    if (ret == 0)
+        return 0;
     fprintf(stderr, "Error in driver_recv.\n%s.\n", pcap_geterr(pcap));
     return -1;
 }
 /**
  * @brief 使用网卡发送一个数据包
  *
+ * @param netif 发送的网卡
  * @param buf 要发送的数据包
  * @return int 成功为0，失败为-1
  */
-int driver_send(buf_t *buf) {
+int driver_send(net_if_t *netif, buf_t *buf) {
+    pcap_t *pcap = netif->driver;
+    if (pcap == NULL) {
+        fprintf(stderr, "Error in driver_send: interface %u is not open.\n", netif->index);
+        return -1;
+    }
     if (pcap_sendpacket(pcap, buf->data, buf->len) == -1) {
         fprintf(stderr, "Error in driver_send.\n%s.\n", pcap_geterr(pcap));
         return -1;
@@ -181,7 +397,9 @@ int driver_send(buf_t *buf) {
 /**
  * @brief 关闭网卡
  *
+ * @param netif 要关闭的网卡
  */
-void driver_close() {
-    pcap_close(pcap);
+void driver_close(net_if_t *netif) {
+    pcap_close(netif->driver);
+    netif->driver = NULL;
 }
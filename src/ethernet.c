@@ -3,12 +3,13 @@
 #include <string.h>
 #include "arp.h"
 #include "driver.h"
+#include "gro.h"
 #include "ip.h"
 #include "utils.h"
 /**
  * @brief 处理一个收到的数据包
  *
- * @param buf 要处理的数据包
+ * @param buf 要处理的数据包，buf->netif为入口网卡
  */
 void ethernet_in(buf_t *buf) {
     //首先判断数据长度，若数据长度小于以太网头部长度，表明数据包不完整，应将其丢弃，不予处理。
@@ -23,13 +24,25 @@ void ethernet_in(buf_t *buf) {
     uint16_t protocol = swap16(ethernetHeader->protocol16);
     //调用buf_remove_header()函数移除加以太网包头。
     buf_remove_header(buf, sizeof(ether_hdr_t));
+    //带802.1Q标签的帧按VLAN ID直接查表转交给对应的子网卡，未配置的VLAN丢弃。
+    if (protocol == ETHERNET_VLAN_TPID) {
+        if (buf->len < sizeof(vlan_hdr_t))
+            return;
+        vlan_hdr_t *vlanHeader = (vlan_hdr_t *)buf->data;
+        uint8_t index = buf->netif->vlan_table[swap16(vlanHeader->tci16) & ETHERNET_VLAN_ID_MASK];
+        if (index == 0)
+            return;
+        buf->netif = &net_if_list[index];
+        protocol = swap16(vlanHeader->protocol16);
+        buf_remove_header(buf, sizeof(vlan_hdr_t));
+    }
     //调用net_in()函数向上层传递数据包。
     net_in(buf, protocol, src_mac);
 }
 /**
  * @brief 处理一个要发送的数据包
  *
- * @param buf 要处理的数据包
+ * @param buf 要处理的数据包，从buf->netif发出
  * @param mac 目标MAC地址
  * @param protocol 上层协议
  */
@@ -39,7 +52,18 @@ void ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol) {
     if (dataLength < ETHERNET_MIN_TRANSPORT_UNIT)
         buf_add_padding(buf, ETHERNET_MIN_TRANSPORT_UNIT - dataLength);
 
-    /* Step2: 添加以太网包头 */
+    /* Step2: VLAN子网卡插入802.1Q标签，从所属物理网卡发出 */
+    net_if_t *netif = buf->netif;
+    if (netif->parent) {
+        buf_add_header(buf, sizeof(vlan_hdr_t));
+        vlan_hdr_t *vlanHeader = (vlan_hdr_t *)buf->data;
+        vlanHeader->tci16 = swap16(netif->vlan_id);
+        vlanHeader->protocol16 = swap16((uint16_t)protocol);
+        protocol = ETHERNET_VLAN_TPID;
+        netif = netif->parent;
+    }
+
+    /* Step2.5: 添加以太网包头 */
     buf_add_header(buf, sizeof(ether_hdr_t));
     ether_hdr_t *ethernetHeader = (ether_hdr_t *)buf->data;
 
@@ -47,27 +71,50 @@ void ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol) {
     memcpy(ethernetHeader->dst, mac, NET_MAC_LEN);
 
     /* Step4: 填写源MAC地址（本机MAC） */
-    memcpy(ethernetHeader->src, net_if_mac, NET_MAC_LEN);
+    memcpy(ethernetHeader->src, netif->mac, NET_MAC_LEN);
 
     /* Step5: 填写协议类型 */
     ethernetHeader->protocol16 = swap16((uint16_t)protocol);
 
     /* Step6: 发送数据帧 */
-    driver_send(buf);
+    driver_send(netif, buf);
 }
+/**
+ * @brief 接收队列，一次轮询从一个物理网卡收到的一批包。
+ *        一批包处理完后才轮询下一个网卡，所有物理网卡共用一个队列
+ *
+ */
+static buf_t rxbuf[NET_RX_BURST];
+
 /**
  * @brief 初始化以太网协议
  *
  */
 void ethernet_init() {
-    buf_init(&rxbuf, ETHERNET_MAX_TRANSPORT_UNIT + sizeof(ether_hdr_t));
+    for (size_t j = 0; j < NET_RX_BURST; j++)
+        buf_init(&rxbuf[j], ETHERNET_MAX_TRANSPORT_UNIT + sizeof(ether_hdr_t) + sizeof(vlan_hdr_t));
 }
 
 /**
- * @brief 一次以太网轮询
+ * @brief 一次以太网轮询，从每个物理网卡接收一批包，经GRO合并后逐个处理
  *
  */
 void ethernet_poll() {
-    if (driver_recv(&rxbuf) > 0)
-        ethernet_in(&rxbuf);
+    for (size_t i = 0; i < net_if_num; i++) {
+        net_if_t *netif = &net_if_list[i];
+        if (netif->parent || !netif->driver)  // 未打开的网卡
+            continue;
+        buf_t *burst[NET_RX_BURST];
+        size_t num = 0;
+        for (; num < netif->rx_budget; num++) {
+            // 上一批包的处理可能移动了数据起始地址，按本网卡的最大帧长重新初始化
+            buf_init(&rxbuf[num], netif->mtu + sizeof(ether_hdr_t) + sizeof(vlan_hdr_t));
+            if (driver_recv(netif, &rxbuf[num]) <= 0)
+                break;
+            burst[num] = &rxbuf[num];
+        }
+        num = gro_receive(burst, num);
+        for (size_t j = 0; j < num; j++)
+            ethernet_in(burst[j]);
+    }
 }
@@ -0,0 +1,166 @@
+#include "gro.h"
+
+#include "ethernet.h"
+#include "ip.h"
+#include "tcp.h"
+
+/**
+ * @brief 一个可合并的TCP报文段在以太网帧中的解析结果
+ *
+ */
+typedef struct gro_seg {
+    buf_t *buf;          // 所在的帧
+    size_t l3_offset;    // IP头在帧中的偏移
+    ip_hdr_t *ip;        // IP头
+    tcp_hdr_t *tcp;      // TCP头
+    size_t tcp_hdr_len;  // TCP头长度（含选项）
+    size_t data_len;     // TCP负载长度
+    uint32_t seq;        // 序列号
+} gro_seg_t;
+
+/**
+ * @brief 解析一个收到的以太网帧，判断其是否为可合并的TCP数据段
+ *
+ * @param buf 收到的以太网帧
+ * @param seg 出口参数，解析结果
+ * @return int 可合并为0，否则为-1
+ */
+static int gro_parse(buf_t *buf, gro_seg_t *seg) {
+    size_t offset = sizeof(ether_hdr_t);
+    if (buf->len < offset)
+        return -1;
+    uint16_t protocol = swap16(((ether_hdr_t *)buf->data)->protocol16);
+    if (protocol == ETHERNET_VLAN_TPID) {
+        if (buf->len < offset + sizeof(vlan_hdr_t))
+            return -1;
+        protocol = swap16(((vlan_hdr_t *)(buf->data + offset))->protocol16);
+        offset += sizeof(vlan_hdr_t);
+    }
+    if (protocol != NET_PROTOCOL_IP || buf->len < offset + sizeof(ip_hdr_t))
+        return -1;
+
+    // 仅合并首部完好、无选项、未分片的TCP数据报
+    ip_hdr_t *ip = (ip_hdr_t *)(buf->data + offset);
+    size_t total_len = swap16(ip->total_len16);
+    if (ip->version != IP_VERSION_4 || ip->hdr_len * IP_HDR_LEN_PER_BYTE != sizeof(ip_hdr_t) || ip->protocol != NET_PROTOCOL_TCP)
+        return -1;
+    if ((swap16(ip->flags_fragment16) & (IP_MORE_FRAGMENT | IP_FRAGMENT_OFFSET)) || total_len > buf->len - offset || total_len < sizeof(ip_hdr_t) + sizeof(tcp_hdr_t))
+        return -1;
+    if (checksum16((uint16_t *)ip, sizeof(ip_hdr_t)) != 0)
+        return -1;
+
+    // 仅合并只带ACK/PSH标志且携带数据的报文段
+    tcp_hdr_t *tcp = (tcp_hdr_t *)(ip + 1);
+    size_t tcp_hdr_len = (tcp->doff >> 4) * 4;
+    if (tcp_hdr_len < sizeof(tcp_hdr_t) || total_len <= sizeof(ip_hdr_t) + tcp_hdr_len)
+        return -1;
+    if ((tcp->flags & 0x3f & ~TCP_FLG_PSH) != TCP_FLG_ACK)
+        return -1;
+
+    seg->buf = buf;
+    seg->l3_offset = offset;
+    seg->ip = ip;
+    seg->tcp = tcp;
+    seg->tcp_hdr_len = tcp_hdr_len;
+    seg->data_len = total_len - sizeof(ip_hdr_t) - tcp_hdr_len;
+    seg->seq = swap32(tcp->seq);
+    return 0;
+}
+
+/**
+ * @brief 判断报文段是否紧接在聚合包之后，且属于同一条流、首部除序列号外完全一致
+ *
+ * @param agg 聚合包
+ * @param seg 报文段
+ * @return int 可合并为1，否则为0
+ */
+static int gro_can_merge(gro_seg_t *agg, gro_seg_t *seg) {
+    return agg->seq + agg->data_len == seg->seq &&
+           agg->l3_offset == seg->l3_offset &&
+           sizeof(ip_hdr_t) + agg->tcp_hdr_len + agg->data_len + seg->data_len <= GRO_MAX_SIZE &&
+           agg->tcp->doff == seg->tcp->doff &&
+           (uint8_t *)agg->tcp + agg->tcp_hdr_len + agg->data_len + seg->data_len <= agg->buf->payload + BUF_MAX_LEN &&
+           !memcmp(agg->buf->data, seg->buf->data, agg->l3_offset) &&  // 以太网头与VLAN标签
+           agg->ip->tos == seg->ip->tos && agg->ip->ttl == seg->ip->ttl &&
+           !memcmp(agg->ip->src_ip, seg->ip->src_ip, 2 * NET_IP_LEN) &&
+           agg->tcp->src_port16 == seg->tcp->src_port16 && agg->tcp->dst_port16 == seg->tcp->dst_port16 &&
+           agg->tcp->ack == seg->tcp->ack && agg->tcp->win == seg->tcp->win &&
+           !memcmp(agg->tcp + 1, seg->tcp + 1, agg->tcp_hdr_len - sizeof(tcp_hdr_t));  // TCP选项
+}
+
+/**
+ * @brief 校验报文段的TCP校验和
+ *
+ * @param seg 要校验的报文段
+ * @return int 正确为1，错误为0
+ */
+static int gro_checksum(gro_seg_t *seg) {
+    buf_t *buf = seg->buf;
+    uint8_t *data = buf->data;
+    size_t len = buf->len;
+    uint16_t checksum = seg->tcp->checksum16;
+
+    // 临时将buf指向TCP报文段以复用transport_checksum
+    buf->data = (uint8_t *)seg->tcp;
+    buf->len = seg->tcp_hdr_len + seg->data_len;
+    seg->tcp->checksum16 = 0;
+    int ok = transport_checksum(NET_PROTOCOL_TCP, buf, seg->ip->src_ip, seg->ip->dst_ip) == checksum;
+    seg->tcp->checksum16 = checksum;
+    buf->data = data;
+    buf->len = len;
+    return ok;
+}
+
+/**
+ * @brief 将报文段的负载追加到聚合包，并更新IP总长度与首部校验和
+ *
+ * @param agg 聚合包
+ * @param seg 要追加的报文段
+ */
+static void gro_merge(gro_seg_t *agg, gro_seg_t *seg) {
+    size_t total_len = sizeof(ip_hdr_t) + agg->tcp_hdr_len + agg->data_len;
+    memcpy((uint8_t *)agg->ip + total_len, (uint8_t *)seg->tcp + seg->tcp_hdr_len, seg->data_len);
+    agg->data_len += seg->data_len;
+    total_len += seg->data_len;
+    agg->buf->len = agg->l3_offset + total_len;  // 同时去除以太网填充
+
+    agg->ip->total_len16 = swap16(total_len);
+    agg->ip->hdr_checksum16 = 0;
+    agg->ip->hdr_checksum16 = swap16(checksum16((uint16_t *)agg->ip, sizeof(ip_hdr_t)));
+    agg->tcp->flags |= seg->tcp->flags;  // 保留PSH
+}
+
+/**
+ * @brief 对一批收到的以太网帧做接收合并（GRO），把同一条流中首尾相接的TCP数据段合并为一个大包
+ *
+ * @param bufs 收到的帧，合并后原地压缩为要交付的帧
+ * @param num 帧数量
+ * @return size_t 合并后要交付的帧数量
+ */
+size_t gro_receive(buf_t **bufs, size_t num) {
+    gro_seg_t agg, seg;
+    int has_agg = 0;
+    size_t out = 0;
+    for (size_t i = 0; i < num; i++) {
+        buf_t *buf = bufs[i];
+        buf->csum_ok = 0;
+        if (gro_parse(buf, &seg) < 0) {
+            has_agg = 0;
+            bufs[out++] = buf;
+            continue;
+        }
+        if (has_agg && gro_can_merge(&agg, &seg)) {
+            // 合并前分别校验两者的TCP校验和，合并后的包上层无需再校验
+            if (!agg.buf->csum_ok)
+                agg.buf->csum_ok = gro_checksum(&agg);
+            if (agg.buf->csum_ok && gro_checksum(&seg)) {
+                gro_merge(&agg, &seg);
+                continue;
+            }
+        }
+        agg = seg;
+        has_agg = 1;
+        bufs[out++] = buf;
+    }
+    return out;
+}
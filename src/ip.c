@@ -46,8 +46,8 @@ void ip_in(buf_t *buf, uint8_t *src_mac) {
     hdr->hdr_checksum16 = received_checksum;  // 恢复原校验和
     
     /* Step4: 对比目的IP地址 */
-    if (memcmp(hdr->dst_ip, net_if_ip, NET_IP_LEN) != 0) {
-        // 目的IP地址不是本机IP，丢弃
+    if (memcmp(hdr->dst_ip, buf->netif->ip, NET_IP_LEN) != 0) {
+        // 目的IP地址不是入口网卡的IP，丢弃
         return;
     }
     
@@ -73,7 +73,7 @@ void ip_in(buf_t *buf, uint8_t *src_mac) {
 /**
  * @brief 处理一个要发送的ip分片
  *
- * @param buf 要发送的分片
+ * @param buf 要发送的分片，从buf->netif发出
  * @param ip 目标ip地址
  * @param protocol 上层协议
  * @param id 数据包id
@@ -101,7 +101,7 @@ void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, u
     
     hdr->ttl = IP_DEFALUT_TTL;
     hdr->protocol = protocol;
-    memcpy(hdr->src_ip, net_if_ip, NET_IP_LEN);
+    memcpy(hdr->src_ip, buf->netif->ip, NET_IP_LEN);
     memcpy(hdr->dst_ip, ip, NET_IP_LEN);
     
     /* Step3: 计算并填写校验和 */
@@ -112,6 +112,8 @@ void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, u
     arp_out(buf, ip);
 }
 
+static buf_t ip_frag_buf;  // 分片buf，不放在栈上，协程的栈容纳不下
+
 /**
  * @brief 处理一个要发送的ip数据包
  *
@@ -120,15 +122,31 @@ void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, u
  * @param protocol 上层协议
  */
 void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol) {
-    /* Step1: 检查数据报包长 */
+    ip_out_from(buf, NULL, ip, protocol);
+}
+
+/**
+ * @brief 以指定的本端地址发送一个ip数据包，已绑定本端地址的连接用它保证源地址不随路由变化
+ *
+ * @param buf 要处理的包
+ * @param src_ip 本端ip地址，为NULL时按目标地址路由
+ * @param ip 目标ip地址
+ * @param protocol 上层协议
+ */
+void ip_out_from(buf_t *buf, uint8_t *src_ip, uint8_t *ip, net_protocol_t protocol) {
+    /* Step1: 选择出口网卡，检查数据报包长 */
+    net_if_t *netif = net_if_select(src_ip, ip);
+    buf->netif = netif;
     // IP协议最大负载包长 = MTU - IP首部长度
-    size_t max_payload = ETHERNET_MAX_TRANSPORT_UNIT - sizeof(ip_hdr_t);
+    size_t max_payload = netif->mtu - sizeof(ip_hdr_t);
     
     /* Step2: 分片处理 */
     if (buf->len > max_payload) {
         // 需要分片发送
         static int packet_id = 0;  // 数据包ID（每个数据包递增）
         int id = packet_id++;
+        // 非最后分片的长度必须是8的整数倍（巨型帧MTU不一定满足）
+        max_payload -= max_payload % IP_HDR_OFFSET_PER_BYTE;
         
         size_t offset = 0;  // 当前分片偏移量
         uint8_t *data_ptr = buf->data;  // 指向当前要发送的数据
@@ -136,14 +154,14 @@ void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol) {
         
         while (remaining > max_payload) {
             // 初始化一个分片buf
-            buf_t ip_buf;
-            buf_init(&ip_buf, max_payload);
+            buf_init(&ip_frag_buf, max_payload);
+            ip_frag_buf.netif = netif;
             
             // 复制数据到分片buf
-            memcpy(ip_buf.data, data_ptr, max_payload);
+            memcpy(ip_frag_buf.data, data_ptr, max_payload);
             
             // 发送分片（MF=1，表示后面还有分片）
-            ip_fragment_out(&ip_buf, ip, protocol, id, offset, 1);
+            ip_fragment_out(&ip_frag_buf, ip, protocol, id, offset, 1);
             
             // 更新偏移量和剩余数据
             offset += max_payload;
@@ -152,12 +170,12 @@ void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol) {
         }
         
         // 发送最后一个分片
-        buf_t ip_buf;
-        buf_init(&ip_buf, remaining);
-        memcpy(ip_buf.data, data_ptr, remaining);
+        buf_init(&ip_frag_buf, remaining);
+        ip_frag_buf.netif = netif;
+        memcpy(ip_frag_buf.data, data_ptr, remaining);
         
         // 最后一个分片，MF=0
-        ip_fragment_out(&ip_buf, ip, protocol, id, offset, 0);
+        ip_fragment_out(&ip_frag_buf, ip, protocol, id, offset, 0);
     }
     /* Step3: 直接发送 */
     else {
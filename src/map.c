@@ -64,6 +64,20 @@ int map_entry_valid(map_t *map, const void *entry) {
     return entry_time && (!map->timeout || entry_time + map->timeout >= time(NULL));
 }
 
+/**
+ * @brief 内部函数，回收超时的键值对，使其不再计入map大小
+ *
+ * @param map 要操作的map
+ * @param entry 键值对指针
+ */
+void map_entry_reap(map_t *map, void *entry) {
+    time_t *entry_time = (time_t *)((uint8_t *)entry + map->key_len + map->value_len);
+    if (*entry_time && !map_entry_valid(map, entry)) {
+        *entry_time = 0;
+        map->size--;
+    }
+}
+
 /**
  * @brief 获取map中指定键的值
  *
@@ -76,6 +90,7 @@ void *map_get(map_t *map, const void *key) {
         return NULL;
     for (size_t i = 0; i < map->max_size; i++) {
         uint8_t *entry = map_entry_get(map, i);
+        map_entry_reap(map, entry);
         if (map_entry_valid(map, entry) && !map->key_compare(key, entry, map->key_len))
             return entry + map->key_len;
     }
@@ -136,6 +151,7 @@ void map_delete(map_t *map, const void *key) {
 void map_foreach(map_t *map, map_entry_handler_t handler) {
     for (size_t i = 0; i < map->max_size; i++) {
         uint8_t *entry = map_entry_get(map, i);
+        map_entry_reap(map, entry);
         if (map_entry_valid(map, entry))
             handler(entry, entry + map->key_len, (time_t *)(entry + map->key_len + map->value_len));
     }
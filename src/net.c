@@ -15,22 +15,41 @@
 map_t net_table;
 
 /**
- * @brief 网卡MAC地址
+ * @brief 本机打开的端口表 <net_port_t,占位>的容器，用于生成网卡的包过滤器
  *
  */
-uint8_t net_if_mac[NET_MAC_LEN] = NET_IF_MAC;
+map_t net_port_table;
 
 /**
- * @brief 网卡IP地址
+ * @brief 网卡表，0号网卡为config.h中配置的默认网卡，其余网卡由net_if_add添加
  *
  */
-uint8_t net_if_ip[NET_IP_LEN] = NET_IF_IP;
+net_if_t net_if_list[NET_IF_MAX_NUM] = {
+    {.index = 0,
+     .ip = NET_IF_IP,
+     .mac = NET_IF_MAC,
+     .prefix_len = NET_IF_PREFIX_LEN,
+     .mtu = NET_IF_MTU,
+     .capture = {DRIVER_IMMEDIATE_MODE, DRIVER_TIMEOUT_MS, DRIVER_BUFFER_SIZE, DRIVER_AUTOTUNE, DRIVER_STATS_REPORT},
+     .rx_budget = NET_RX_BUDGET}};
 
 /**
- * @brief 网卡接收和发送缓冲区
+ * @brief 网卡数量
  *
  */
-buf_t rxbuf, txbuf;  // 一个buf足够单线程使用
+size_t net_if_num = 1;
+
+/**
+ * @brief 网卡是否已打开，打开后修改MTU需要重新打开网卡以更新抓包长度
+ *
+ */
+static int net_driver_opened;
+
+/**
+ * @brief 发送缓冲区，用于各层构造要发送的数据包
+ *
+ */
+buf_t txbuf;  // 一个buf足够单线程使用
 
 /**
  * @brief 初始化协议栈
@@ -38,8 +57,11 @@ buf_t rxbuf, txbuf;  // 一个buf足够单线程使用
  */
 int net_init() {
     map_init(&net_table, sizeof(uint16_t), sizeof(net_handler_t), 0, 0, NULL, NULL);
-    if (driver_open() == -1)
-        return -1;
+    map_init(&net_port_table, sizeof(net_port_t), sizeof(uint8_t), 0, 0, NULL, NULL);
+    for (size_t i = 0; i < net_if_num; i++)
+        if (!net_if_list[i].parent && driver_open(&net_if_list[i]) == -1)  // VLAN子网卡共用物理网卡的驱动
+            return -1;
+    net_driver_opened = 1;
     ethernet_init();
     arp_init();
     ip_init();
@@ -55,6 +77,245 @@ int net_init() {
     return 0;
 }
 
+/**
+ * @brief 检查MTU是否在以太网支持的范围内，最大为ETHERNET_JUMBO_TRANSPORT_UNIT的巨型帧
+ *
+ * @param mtu 要检查的MTU
+ * @return int 合法为1，不合法为0
+ */
+static int net_if_mtu_valid(uint16_t mtu) {
+    if (mtu < ETHERNET_MIN_TRANSPORT_UNIT || mtu > ETHERNET_JUMBO_TRANSPORT_UNIT) {
+        fprintf(stderr, "Error, mtu %u out of range [%d, %d]\n", mtu, ETHERNET_MIN_TRANSPORT_UNIT, ETHERNET_JUMBO_TRANSPORT_UNIT);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief 添加一个网卡，需在net_init之前调用
+ *
+ * @param ip 网卡ip地址
+ * @param prefix_len 子网前缀长度
+ * @param mac 网卡mac地址
+ * @param mtu 网卡MTU
+ * @return int 网卡序号，失败为-1
+ */
+int net_if_add(const uint8_t *ip, uint8_t prefix_len, const uint8_t *mac, uint16_t mtu) {
+    if (net_driver_opened || net_if_num == NET_IF_MAX_NUM || prefix_len > 32) {
+        fprintf(stderr, "Error in net_if_add: %s\n", net_driver_opened ? "stack already started" : "too many interfaces or bad prefix");
+        return -1;
+    }
+    if (!net_if_mtu_valid(mtu))
+        return -1;
+    net_if_t *netif = &net_if_list[net_if_num];
+    memset(netif, 0, sizeof(net_if_t));
+    netif->index = net_if_num;
+    memcpy(netif->ip, ip, NET_IP_LEN);
+    memcpy(netif->mac, mac, NET_MAC_LEN);
+    netif->prefix_len = prefix_len;
+    netif->mtu = mtu;
+    netif->capture = (net_if_capture_t){DRIVER_IMMEDIATE_MODE, DRIVER_TIMEOUT_MS, DRIVER_BUFFER_SIZE, DRIVER_AUTOTUNE, DRIVER_STATS_REPORT};
+    netif->rx_budget = NET_RX_BUDGET;
+    return net_if_num++;
+}
+
+/**
+ * @brief 在物理网卡上添加一个802.1Q VLAN子网卡，需在net_init之前调用
+ *
+ * @param parent 物理网卡
+ * @param vlan_id VLAN ID，范围为1~4094
+ * @param ip 子网卡ip地址
+ * @param prefix_len 子网前缀长度
+ * @return int 网卡序号，失败为-1
+ */
+int net_if_add_vlan(net_if_t *parent, uint16_t vlan_id, const uint8_t *ip, uint8_t prefix_len) {
+    if (parent->parent || vlan_id == 0 || vlan_id >= NET_VLAN_NUM - 1 || parent->vlan_table[vlan_id]) {
+        fprintf(stderr, "Error in net_if_add_vlan: bad vlan id %u on interface %u\n", vlan_id, parent->index);
+        return -1;
+    }
+    int index = net_if_add(ip, prefix_len, parent->mac, parent->mtu);
+    if (index < 0)
+        return -1;
+    net_if_list[index].vlan_id = vlan_id;
+    net_if_list[index].parent = parent;
+    parent->vlan_table[vlan_id] = index;
+    return index;
+}
+
+/**
+ * @brief 获取指定序号的网卡
+ *
+ * @param index 网卡序号
+ * @return net_if_t* 网卡，不存在为NULL
+ */
+net_if_t *net_if_get(size_t index) {
+    return index < net_if_num ? &net_if_list[index] : NULL;
+}
+
+/**
+ * @brief 路由选择，在子网包含目标地址的网卡中选取前缀最长的一个
+ *
+ * @param dst_ip 目标ip地址
+ * @return net_if_t* 出口网卡，没有匹配的子网时使用0号网卡
+ */
+net_if_t *net_if_route(const uint8_t *dst_ip) {
+    net_if_t *best = &net_if_list[0];
+    int best_len = -1;
+    for (size_t i = 0; i < net_if_num; i++) {
+        net_if_t *netif = &net_if_list[i];
+        if (netif->prefix_len > best_len && ip_prefix_match((uint8_t *)dst_ip, netif->ip) >= netif->prefix_len)
+            best = netif, best_len = netif->prefix_len;
+    }
+    return best;
+}
+
+/**
+ * @brief 选择出口网卡，本端地址属于某个网卡时从该网卡发出，使应答的源地址与请求的目的地址一致
+ *
+ * @param src_ip 本端ip地址，为NULL时按目标地址路由
+ * @param dst_ip 目标ip地址
+ * @return net_if_t* 出口网卡
+ */
+net_if_t *net_if_select(const uint8_t *src_ip, const uint8_t *dst_ip) {
+    if (src_ip)
+        for (size_t i = 0; i < net_if_num; i++)
+            if (memcmp(net_if_list[i].ip, src_ip, NET_IP_LEN) == 0)
+                return &net_if_list[i];
+    return net_if_route(dst_ip);
+}
+
+/**
+ * @brief 重新打开物理网卡以应用新的抓包参数，协议栈未启动时无需操作。
+ *        先打开新句柄再关闭原句柄，失败时网卡继续使用原句柄，参数恢复为原值
+ *
+ * @param netif 物理网卡，已写入新的参数
+ * @param old_capture 原抓包参数
+ * @param old_mtu 原MTU
+ * @return int 成功为0，失败为-1
+ */
+static int net_if_reopen(net_if_t *netif, const net_if_capture_t *old_capture, uint16_t old_mtu) {
+    if (!net_driver_opened)
+        return 0;
+    void *old_driver = netif->driver;
+    net_if_stats_t old_stats = netif->stats;
+    if (driver_open(netif) == -1) {
+        fprintf(stderr, "Error, failed to reopen interface %u, keeping the old capture\n", netif->index);
+        netif->driver = old_driver;
+        netif->stats = old_stats;
+        netif->capture = *old_capture;
+        netif->mtu = old_mtu;
+        return -1;
+    }
+    void *new_driver = netif->driver;
+    netif->driver = old_driver;
+    driver_close(netif);
+    netif->driver = new_driver;
+    ethernet_init();
+    return 0;
+}
+
+/**
+ * @brief 修改网卡MTU
+ *
+ * @param netif 要修改的网卡
+ * @param mtu 新的MTU
+ * @return int 成功为0，失败为-1
+ */
+int net_if_set_mtu(net_if_t *netif, uint16_t mtu) {
+    if (!net_if_mtu_valid(mtu))
+        return -1;
+    if (netif->parent) {  // VLAN子网卡不能超过物理网卡的MTU
+        if (mtu > netif->parent->mtu) {
+            fprintf(stderr, "Error in net_if_set_mtu: %u exceeds parent mtu %u\n", mtu, netif->parent->mtu);
+            return -1;
+        }
+        netif->mtu = mtu;
+        return 0;
+    }
+    // 抓包长度在打开网卡时确定，需重新打开网卡，成功后再调整VLAN子网卡
+    uint16_t old_mtu = netif->mtu;
+    netif->mtu = mtu;
+    if (net_if_reopen(netif, &netif->capture, old_mtu) == -1)
+        return -1;
+    for (size_t i = 0; i < net_if_num; i++)
+        if (net_if_list[i].parent == netif && net_if_list[i].mtu > mtu)
+            net_if_list[i].mtu = mtu;
+    return 0;
+}
+
+/**
+ * @brief 修改物理网卡的抓包参数，协议栈已启动时重新打开网卡
+ *
+ * @param netif 物理网卡
+ * @param immediate 是否使用即时模式
+ * @param timeout 非即时模式下的读超时(毫秒)
+ * @param buffer_size 内核抓包缓冲区大小(字节)
+ * @return int 成功为0，失败为-1
+ */
+int net_if_set_capture(net_if_t *netif, uint8_t immediate, int timeout, int buffer_size) {
+    if (netif->parent || timeout < 0 || buffer_size <= 0) {
+        fprintf(stderr, "Error in net_if_set_capture: bad capture config on interface %u\n", netif->index);
+        return -1;
+    }
+    net_if_capture_t old_capture = netif->capture;
+    netif->capture.immediate = immediate;
+    netif->capture.timeout = timeout;
+    netif->capture.buffer_size = buffer_size;
+    return net_if_reopen(netif, &old_capture, netif->mtu);
+}
+
+/**
+ * @brief 根据当前的地址与端口配置重新生成所有物理网卡的包过滤器
+ *
+ */
+static void net_filter_update() {
+    if (!net_driver_opened)
+        return;
+    for (size_t i = 0; i < net_if_num; i++)
+        if (!net_if_list[i].parent)
+            driver_set_filter(&net_if_list[i]);
+}
+
+/**
+ * @brief 记录一个打开的传输层端口，网卡只向用户态递交发往打开端口的数据包
+ *
+ * @param protocol 传输层协议号
+ * @param port 端口号
+ */
+void net_port_open(uint16_t protocol, uint16_t port) {
+    net_port_range_open(protocol, port, port);
+}
+
+/**
+ * @brief 移除一个打开的传输层端口
+ *
+ * @param protocol 传输层协议号
+ * @param port 端口号
+ */
+void net_port_close(uint16_t protocol, uint16_t port) {
+    net_port_t key = {.protocol = protocol, .port = port, .port_last = port};
+    if (!map_get(&net_port_table, &key))
+        return;
+    map_delete(&net_port_table, &key);
+    net_filter_update();
+}
+
+/**
+ * @brief 记录一段打开的传输层端口，过滤器中只占一项，用于主动打开连接时分配的临时端口
+ *
+ * @param protocol 传输层协议号
+ * @param first 第一个端口号
+ * @param last 最后一个端口号
+ */
+void net_port_range_open(uint16_t protocol, uint16_t first, uint16_t last) {
+    net_port_t key = {.protocol = protocol, .port = first, .port_last = last};
+    uint8_t opened = 1;
+    if (map_get(&net_port_table, &key))
+        return;
+    map_set(&net_port_table, &key, &opened);
+    net_filter_update();
+}
+
 /**
  * @brief 向协议栈注册一个协议
  *
@@ -82,10 +343,49 @@ int net_in(buf_t *buf, uint16_t protocol, uint8_t *src) {
     return -1;
 }
 
+/**
+ * @brief 定期查询各物理网卡的抓包统计，开启报告时打印出来，发现内核丢包时先提高轮询预算，预算已满再扩大缓冲区
+ *
+ */
+static void net_stats_poll() {
+    static time_t last;
+    time_t now = time(NULL);
+    if (now - last < DRIVER_STATS_INTERVAL)
+        return;
+    last = now;
+    for (size_t i = 0; i < net_if_num; i++) {
+        net_if_t *netif = &net_if_list[i];
+        if (netif->parent || !netif->driver)
+            continue;
+        int drops = driver_stats(netif);
+        if (netif->capture.report)
+            driver_print_stats(netif);
+        if (drops <= 0 || !netif->capture.autotune)
+            continue;
+        if (netif->rx_budget < NET_RX_BURST) {
+            netif->rx_budget = netif->rx_budget * 2 < NET_RX_BURST ? netif->rx_budget * 2 : NET_RX_BURST;
+            fprintf(stderr, "Interface %u dropping packets, rx budget raised to %u\n", netif->index, netif->rx_budget);
+        } else if (netif->capture.buffer_size < DRIVER_BUFFER_MAX_SIZE) {
+            // 缓冲区大小在打开网卡时确定，需重新打开网卡
+            net_if_capture_t old_capture = netif->capture;
+            netif->capture.buffer_size = netif->capture.buffer_size * 2 < DRIVER_BUFFER_MAX_SIZE ? netif->capture.buffer_size * 2 : DRIVER_BUFFER_MAX_SIZE;
+            fprintf(stderr, "Interface %u dropping packets, capture buffer raised to %d bytes\n", netif->index, netif->capture.buffer_size);
+            if (net_if_reopen(netif, &old_capture, netif->mtu) == -1) {  // 保留原缓冲区，不再自动调整
+                netif->capture.autotune = 0;
+                fprintf(stderr, "Interface %u capture autotune disabled\n", netif->index);
+            }
+        }
+    }
+}
+
 /**
  * @brief 一次协议栈轮询
  *
  */
 void net_poll() {
     ethernet_poll();
+    net_stats_poll();
+#ifdef TCP
+    tcp_poll();
+#endif
 }
\ No newline at end of file
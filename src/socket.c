@@ -0,0 +1,650 @@
+#include "socket.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum sock_type {
+    SOCK_TYPE_FREE,    // 空闲
+    SOCK_TYPE_LISTEN,  // 监听套接字
+    SOCK_TYPE_STREAM,  // 已接受或主动打开的连接
+} sock_type_t;
+
+typedef struct sock {
+    sock_type_t type;
+    tcp_conn_t *tcp_conn;  // 连接已释放时为NULL
+    uint16_t port;         // 监听套接字的端口
+
+    /* 监听套接字上等待接受的连接，通过 next 串成队列；空闲套接字的 next 为空闲链表的下一个 */
+    int next;
+    int accept_head;
+    int accept_tail;
+    uint16_t accept_len;
+
+    /* 多路复用器，就绪链表为双向链表，关闭套接字时可以直接移除 */
+    int poller;         // 注册到的多路复用器，-1 为未注册
+    uint32_t interest;  // 关注的事件（SOCK_POLL*）
+    uint8_t ready;      // 是否在就绪链表中
+    int ready_prev;
+    int ready_next;
+
+    /* 连接释放时接管的接收缓冲区，对端关闭前发送的数据仍然可以读取 */
+    uint8_t *rcv_buf;
+    size_t rcv_size;
+    size_t rcv_head;
+    size_t rcv_len;
+} sock_t;
+
+typedef struct sock_poller {  // 多路复用器，只检查就绪链表中的套接字，与注册的套接字总数无关
+    uint8_t used;
+    int ready_head;
+    int ready_tail;
+    size_t ready_len;
+} sock_poller_t;
+
+/**
+ * @brief 套接字表及其空闲链表，套接字描述符即表中的下标
+ *
+ */
+static sock_t sock_table[SOCK_MAX_NUM];
+static int sock_free;
+/**
+ * @brief 监听套接字表
+ *
+ */
+static map_t sock_listen_table;  // port -> fd
+/**
+ * @brief 多路复用器表
+ *
+ */
+static sock_poller_t sock_poller_table[SOCK_POLLER_NUM];
+
+/**
+ * @brief 检查套接字描述符，出错时设置 errno
+ *
+ * @param fd        套接字描述符
+ * @return sock_t*  描述符无效时为NULL
+ */
+static sock_t *sock_get(int fd) {
+    if (fd < 0 || fd >= SOCK_MAX_NUM || sock_table[fd].type == SOCK_TYPE_FREE) {
+        errno = EBADF;
+        return NULL;
+    }
+    return &sock_table[fd];
+}
+
+/**
+ * @brief 分配一个套接字
+ *
+ * @param type  套接字类型
+ * @return int  套接字描述符，套接字表已满时为-1
+ */
+static int sock_alloc(sock_type_t type) {
+    int fd = sock_free;
+    if (fd < 0) {
+        errno = EMFILE;
+        return -1;
+    }
+    sock_t *sock = &sock_table[fd];
+    sock_free = sock->next;
+    memset(sock, 0, sizeof(sock_t));
+    sock->type = type;
+    sock->next = -1;
+    sock->accept_head = -1;
+    sock->accept_tail = -1;
+    sock->poller = -1;
+    sock->ready_prev = -1;
+    sock->ready_next = -1;
+    return fd;
+}
+
+/**
+ * @brief 把套接字从多路复用器的就绪链表中移除
+ *
+ * @param fd    套接字描述符
+ */
+static void sock_unready(int fd) {
+    sock_t *sock = &sock_table[fd];
+    if (!sock->ready)
+        return;
+    sock_poller_t *poller = &sock_poller_table[sock->poller];
+    if (sock->ready_prev >= 0)
+        sock_table[sock->ready_prev].ready_next = sock->ready_next;
+    else
+        poller->ready_head = sock->ready_next;
+    if (sock->ready_next >= 0)
+        sock_table[sock->ready_next].ready_prev = sock->ready_prev;
+    else
+        poller->ready_tail = sock->ready_prev;
+    sock->ready = 0;
+    sock->ready_prev = -1;
+    sock->ready_next = -1;
+    poller->ready_len--;
+}
+
+/**
+ * @brief 套接字的状态发生了变化，加入多路复用器的就绪链表，由 sock_poller_wait() 检查是否就绪
+ *
+ * @param fd    套接字描述符
+ */
+static void sock_wake(int fd) {
+    sock_t *sock = &sock_table[fd];
+    if (sock->poller < 0 || sock->ready)
+        return;
+    sock_poller_t *poller = &sock_poller_table[sock->poller];
+    sock->ready = 1;
+    sock->ready_prev = poller->ready_tail;
+    sock->ready_next = -1;
+    if (poller->ready_tail >= 0)
+        sock_table[poller->ready_tail].ready_next = fd;
+    else
+        poller->ready_head = fd;
+    poller->ready_tail = fd;
+    poller->ready_len++;
+}
+
+/**
+ * @brief 释放套接字，连接释放时接管的接收缓冲区一并释放
+ *
+ * @param fd    套接字描述符
+ */
+static void sock_release(int fd) {
+    sock_t *sock = &sock_table[fd];
+    sock_unready(fd);
+    if (sock->tcp_conn)
+        sock->tcp_conn->user = NULL;
+    free(sock->rcv_buf);
+    sock->type = SOCK_TYPE_FREE;
+    sock->tcp_conn = NULL;
+    sock->rcv_buf = NULL;
+    sock->next = sock_free;
+    sock_free = fd;
+}
+
+/**
+ * @brief 计算套接字当前就绪的事件
+ *
+ * @param sock      套接字
+ * @return uint32_t 就绪的事件（SOCK_POLL*）
+ */
+static uint32_t sock_events(sock_t *sock) {
+    if (sock->type == SOCK_TYPE_LISTEN)
+        return sock->accept_head >= 0 ? SOCK_POLLIN : 0;
+
+    tcp_conn_t *tcp_conn = sock->tcp_conn;
+    if (tcp_conn == NULL)  // 剩余的数据读完后 sock_read() 返回0
+        return SOCK_POLLIN | SOCK_POLLHUP;
+    uint32_t events = 0;
+    switch (tcp_conn->state) {
+        case TCP_STATE_ESTABLISHED:
+            if (tcp_conn->rcv_len)
+                events |= SOCK_POLLIN;
+            if (!(tcp_conn->snd_ctl & TCP_FLG_FIN) && tcp_conn->snd_len < SOCK_SEND_BUFFER_SIZE)
+                events |= SOCK_POLLOUT;
+            break;
+        case TCP_STATE_CLOSE_WAIT:  // 对端已关闭，读到文件尾
+            events |= SOCK_POLLIN;
+            if (!(tcp_conn->snd_ctl & TCP_FLG_FIN) && tcp_conn->snd_len < SOCK_SEND_BUFFER_SIZE)
+                events |= SOCK_POLLOUT;
+            break;
+        case TCP_STATE_FIN_WAIT1:
+        case TCP_STATE_FIN_WAIT2:
+            if (tcp_conn->rcv_len)
+                events |= SOCK_POLLIN;
+            break;
+        case TCP_STATE_CLOSING:
+        case TCP_STATE_LAST_ACK:
+        case TCP_STATE_TIME_WAIT:
+            events |= SOCK_POLLIN;
+            break;
+        default:  // 握手尚未完成
+            break;
+    }
+    return events;
+}
+
+/**
+ * @brief 从连接释放时接管的接收缓冲区中读取数据
+ *
+ * @param sock      套接字
+ * @param buf       目标地址
+ * @param len       最多读取的长度
+ * @return size_t   读取的长度
+ */
+static size_t sock_rcvbuf_read(sock_t *sock, uint8_t *buf, size_t len) {
+    if (len > sock->rcv_len)
+        len = sock->rcv_len;
+    if (len == 0)
+        return 0;
+    size_t first = sock->rcv_size - sock->rcv_head < len ? sock->rcv_size - sock->rcv_head : len;
+    memcpy(buf, sock->rcv_buf + sock->rcv_head, first);
+    memcpy(buf + first, sock->rcv_buf, len - first);
+    sock->rcv_head = (sock->rcv_head + len) % sock->rcv_size;
+    sock->rcv_len -= len;
+    return len;
+}
+
+/**
+ * @brief 被动打开的连接建立后为其分配套接字，加入监听套接字的 accept 队列
+ *
+ * @param tcp_conn  新连接
+ */
+static void sock_accept_in(tcp_conn_t *tcp_conn) {
+    int *lfd = map_get(&sock_listen_table, &tcp_conn->key.host_port);
+    sock_t *listener = lfd ? &sock_table[*lfd] : NULL;
+    int fd = -1;
+    if (listener && listener->accept_len < SOCK_BACKLOG)
+        fd = sock_alloc(SOCK_TYPE_STREAM);
+    if (fd < 0) {  // 无法接受的连接由协议栈关闭，收到的数据被丢弃
+        tcp_shutdown(tcp_conn);
+        return;
+    }
+    sock_t *sock = &sock_table[fd];
+    sock->tcp_conn = tcp_conn;
+    tcp_conn->user = sock;
+    if (listener->accept_tail >= 0)
+        sock_table[listener->accept_tail].next = fd;
+    else
+        listener->accept_head = fd;
+    listener->accept_tail = fd;
+    listener->accept_len++;
+    sock_wake(*lfd);
+}
+
+/**
+ * @brief 连接状态变化的通知
+ *
+ * @param tcp_conn  TCP 连接
+ * @param events    发生的事件（TCP_EVENT_*）
+ */
+static void sock_tcp_notify(tcp_conn_t *tcp_conn, uint8_t events) {
+    if (events & TCP_EVENT_ACCEPT) {
+        sock_accept_in(tcp_conn);
+        return;
+    }
+    sock_t *sock = tcp_conn->user;
+    if (sock == NULL)
+        return;
+    if (events & TCP_EVENT_CLOSE) {  // 接管未读的数据，连接指针随后失效
+        sock->rcv_buf = tcp_conn->rcv_buf;
+        sock->rcv_size = tcp_conn->rcv_size;
+        sock->rcv_head = tcp_conn->rcv_head;
+        sock->rcv_len = tcp_conn->rcv_len;
+        tcp_conn->rcv_buf = NULL;
+        tcp_conn->rcv_len = 0;
+        tcp_conn->user = NULL;
+        sock->tcp_conn = NULL;
+    }
+    sock_wake(sock - sock_table);
+}
+
+/**
+ * @brief 连接的接收缓冲区中有新数据、对端关闭，或主动打开的连接已建立
+ *
+ */
+static void sock_tcp_handler(tcp_conn_t *tcp_conn, uint8_t *data, size_t len, uint8_t *src_ip, uint16_t src_port) {
+    sock_t *sock = tcp_conn->user;
+    if (sock) {
+        sock_wake(sock - sock_table);
+        return;
+    }
+    // 套接字已关闭，丢弃之后收到的数据，使窗口保持打开直到连接关闭
+    uint8_t discard[1024];
+    while (tcp_read(tcp_conn, discard, sizeof(discard)))
+        ;
+    if (tcp_conn->state == TCP_STATE_CLOSE_WAIT)
+        tcp_shutdown(tcp_conn);
+}
+
+/**
+ * @brief 初始化套接字层，需在 net_init 之后调用
+ *
+ */
+void sock_init() {
+    map_init(&sock_listen_table, sizeof(uint16_t), sizeof(int), 0, 0, NULL, NULL);
+    sock_free = -1;
+    for (int fd = SOCK_MAX_NUM - 1; fd >= 0; fd--) {
+        sock_table[fd].type = SOCK_TYPE_FREE;
+        sock_table[fd].next = sock_free;
+        sock_free = fd;
+    }
+    memset(sock_poller_table, 0, sizeof(sock_poller_table));
+}
+
+/**
+ * @brief 打开一个监听套接字
+ *
+ * @param port  端口号
+ * @return int  套接字描述符，失败为-1
+ */
+int sock_listen(uint16_t port) {
+    if (map_get(&sock_listen_table, &port)) {
+        errno = EADDRINUSE;
+        return -1;
+    }
+    int fd = sock_alloc(SOCK_TYPE_LISTEN);
+    if (fd < 0)
+        return -1;
+    if (tcp_open_buffered(port, sock_tcp_handler) < 0 || map_set(&sock_listen_table, &port, &fd) < 0) {
+        tcp_close(port);
+        sock_release(fd);
+        errno = ENOBUFS;
+        return -1;
+    }
+    tcp_set_notify(port, sock_tcp_notify);
+    sock_table[fd].port = port;
+    return fd;
+}
+
+/**
+ * @brief 接受一个已建立的连接
+ *
+ * @param fd        监听套接字
+ * @param src_ip    对端 IP 地址，可以为NULL
+ * @param src_port  对端端口号，可以为NULL
+ * @return int      新连接的套接字描述符，没有等待接受的连接时为-1且 errno 为 EAGAIN
+ */
+int sock_accept(int fd, uint8_t *src_ip, uint16_t *src_port) {
+    sock_t *listener = sock_get(fd);
+    if (listener == NULL)
+        return -1;
+    if (listener->type != SOCK_TYPE_LISTEN) {
+        errno = EINVAL;
+        return -1;
+    }
+    int cfd = listener->accept_head;
+    if (cfd < 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    sock_t *sock = &sock_table[cfd];
+    listener->accept_head = sock->next;
+    if (listener->accept_head < 0)
+        listener->accept_tail = -1;
+    listener->accept_len--;
+    sock->next = -1;
+    if (sock->tcp_conn) {
+        if (src_ip)
+            memcpy(src_ip, sock->tcp_conn->key.remote_ip, NET_IP_LEN);
+        if (src_port)
+            *src_port = sock->tcp_conn->key.remote_port;
+    }
+    return cfd;
+}
+
+/**
+ * @brief 主动打开一个连接，立即返回，连接建立后套接字变为可写
+ *
+ * @param dst_ip    对端 IP 地址
+ * @param dst_port  对端端口号
+ * @return int      套接字描述符，失败为-1
+ */
+int sock_connect(uint8_t *dst_ip, uint16_t dst_port) {
+    int fd = sock_alloc(SOCK_TYPE_STREAM);
+    if (fd < 0)
+        return -1;
+    tcp_conn_t *tcp_conn = tcp_connect_buffered(dst_ip, dst_port, sock_tcp_handler);
+    if (tcp_conn == NULL) {
+        sock_release(fd);
+        errno = EADDRNOTAVAIL;
+        return -1;
+    }
+    tcp_set_notify(tcp_conn->key.host_port, sock_tcp_notify);
+    tcp_conn->user = &sock_table[fd];
+    sock_table[fd].tcp_conn = tcp_conn;
+    return fd;
+}
+
+/**
+ * @brief 从连接读取数据
+ *
+ * @param fd        套接字描述符
+ * @param buf       目标地址
+ * @param len       最多读取的长度
+ * @return ssize_t  读取的长度，对端已关闭且数据读完时为0，暂无数据时为-1且 errno 为 EAGAIN
+ */
+ssize_t sock_read(int fd, void *buf, size_t len) {
+    sock_t *sock = sock_get(fd);
+    if (sock == NULL)
+        return -1;
+    if (sock->type != SOCK_TYPE_STREAM) {
+        errno = EINVAL;
+        return -1;
+    }
+    tcp_conn_t *tcp_conn = sock->tcp_conn;
+    if (tcp_conn == NULL)
+        return sock_rcvbuf_read(sock, buf, len);
+    size_t n = tcp_read(tcp_conn, buf, len);
+    if (n || len == 0)
+        return n;
+    switch (tcp_conn->state) {
+        case TCP_STATE_CLOSE_WAIT:
+        case TCP_STATE_CLOSING:
+        case TCP_STATE_LAST_ACK:
+        case TCP_STATE_TIME_WAIT:
+            return 0;
+        default:
+            errno = EAGAIN;
+            return -1;
+    }
+}
+
+/**
+ * @brief 向连接写入数据，同一轮中的多次写入在本轮收包结束后合并发送
+ *
+ * @param fd        套接字描述符
+ * @param buf       要发送的数据
+ * @param len       数据长度
+ * @return ssize_t  写入的长度，发送缓冲区已满或连接尚未建立时为-1且 errno 为 EAGAIN
+ */
+ssize_t sock_write(int fd, const void *buf, size_t len) {
+    sock_t *sock = sock_get(fd);
+    if (sock == NULL)
+        return -1;
+    if (sock->type != SOCK_TYPE_STREAM) {
+        errno = EINVAL;
+        return -1;
+    }
+    tcp_conn_t *tcp_conn = sock->tcp_conn;
+    if (tcp_conn && (tcp_conn->state == TCP_STATE_SYN_SENT || tcp_conn->state == TCP_STATE_SYN_RECEIVED)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (tcp_conn == NULL || (tcp_conn->snd_ctl & TCP_FLG_FIN) ||
+        (tcp_conn->state != TCP_STATE_ESTABLISHED && tcp_conn->state != TCP_STATE_CLOSE_WAIT)) {
+        errno = EPIPE;
+        return -1;
+    }
+    if (tcp_conn->snd_len >= SOCK_SEND_BUFFER_SIZE) {
+        errno = EAGAIN;
+        return -1;
+    }
+    size_t room = SOCK_SEND_BUFFER_SIZE - tcp_conn->snd_len;
+    return tcp_write(tcp_conn, buf, len < room ? len : room);
+}
+
+/**
+ * @brief 关闭连接的发送方向，发送缓冲区中的数据发送完毕后发送 FIN，之后仍可读取对端的数据
+ *
+ * @param fd    套接字描述符
+ * @return int  成功为0，失败为-1
+ */
+int sock_shutdown(int fd) {
+    sock_t *sock = sock_get(fd);
+    if (sock == NULL)
+        return -1;
+    if (sock->type != SOCK_TYPE_STREAM) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (sock->tcp_conn == NULL) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    tcp_shutdown(sock->tcp_conn);
+    return 0;
+}
+
+/**
+ * @brief 关闭套接字。连接在发送完缓冲区中的数据后关闭，之后收到的数据被丢弃；
+ *        关闭监听套接字只停止接受新连接，accept 队列中尚未接受的连接被重置，已接受的套接字不受影响
+ *
+ * @param fd    套接字描述符
+ * @return int  成功为0，失败为-1
+ */
+int sock_close(int fd) {
+    sock_t *sock = sock_get(fd);
+    if (sock == NULL)
+        return -1;
+    if (sock->type == SOCK_TYPE_LISTEN) {
+        tcp_unlisten(sock->port);
+        map_delete(&sock_listen_table, &sock->port);
+        while (sock->accept_head >= 0) {
+            int cfd = sock->accept_head;
+            tcp_conn_t *tcp_conn = sock_table[cfd].tcp_conn;
+            sock->accept_head = sock_table[cfd].next;
+            sock_release(cfd);
+            if (tcp_conn)
+                tcp_abort(tcp_conn);
+        }
+        sock_release(fd);
+        return 0;
+    }
+    tcp_conn_t *tcp_conn = sock->tcp_conn;
+    sock_release(fd);
+    if (tcp_conn) {
+        uint8_t discard[1024];
+        while (tcp_read(tcp_conn, discard, sizeof(discard)))
+            ;
+        tcp_shutdown(tcp_conn);
+    }
+    return 0;
+}
+
+/**
+ * @brief 创建一个多路复用器
+ *
+ * @return int  多路复用器描述符，失败为-1
+ */
+int sock_poller_create() {
+    for (int i = 0; i < SOCK_POLLER_NUM; i++) {
+        if (!sock_poller_table[i].used) {
+            sock_poller_table[i] = (sock_poller_t){.used = 1, .ready_head = -1, .ready_tail = -1, .ready_len = 0};
+            return i;
+        }
+    }
+    errno = EMFILE;
+    return -1;
+}
+
+/**
+ * @brief 注册、修改或取消注册套接字关注的事件，一个套接字只能注册到一个多路复用器
+ *
+ * @param poller    多路复用器描述符
+ * @param op        SOCK_CTL_ADD、SOCK_CTL_MOD 或 SOCK_CTL_DEL
+ * @param fd        套接字描述符
+ * @param events    关注的事件（SOCK_POLL*），SOCK_POLLHUP 总是报告
+ * @return int      成功为0，失败为-1
+ */
+int sock_poller_ctl(int poller, int op, int fd, uint32_t events) {
+    if (poller < 0 || poller >= SOCK_POLLER_NUM || !sock_poller_table[poller].used) {
+        errno = EBADF;
+        return -1;
+    }
+    sock_t *sock = sock_get(fd);
+    if (sock == NULL)
+        return -1;
+    switch (op) {
+        case SOCK_CTL_ADD:
+            if (sock->poller >= 0) {
+                errno = EEXIST;
+                return -1;
+            }
+            sock->poller = poller;
+            break;
+        case SOCK_CTL_MOD:
+        case SOCK_CTL_DEL:
+            if (sock->poller != poller) {
+                errno = ENOENT;
+                return -1;
+            }
+            if (op == SOCK_CTL_DEL) {
+                sock_unready(fd);
+                sock->poller = -1;
+                return 0;
+            }
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+    sock->interest = events;
+    sock_wake(fd);  // 注册前可能已经就绪
+    return 0;
+}
+
+/**
+ * @brief 检查就绪链表中的套接字，水平触发的套接字在就绪期间留在链表中，每次都被报告
+ *
+ * @param poller        多路复用器
+ * @param events        输出的就绪事件
+ * @param max_events    最多报告的套接字数
+ * @return int          报告的套接字数
+ */
+static int sock_poller_collect(sock_poller_t *poller, sock_event_t *events, int max_events) {
+    int n = 0;
+    for (size_t left = poller->ready_len; left && n < max_events; left--) {
+        int fd = poller->ready_head;
+        sock_t *sock = &sock_table[fd];
+        sock_unready(fd);
+        uint32_t ready = sock_events(sock) & (sock->interest | SOCK_POLLHUP);
+        if (ready == 0)
+            continue;
+        events[n].events = ready;
+        events[n].fd = fd;
+        n++;
+        if (!(sock->interest & SOCK_POLLET))
+            sock_wake(fd);
+    }
+    return n;
+}
+
+/**
+ * @brief 轮询协议栈并等待注册的套接字就绪，同时发送上一轮写入的数据
+ *
+ * @param poller        多路复用器描述符
+ * @param events        输出的就绪事件
+ * @param max_events    最多报告的套接字数
+ * @param timeout_ms    最长等待时间（毫秒），0 为只轮询一次，-1 为一直等待
+ * @return int          就绪的套接字数，超时为0，失败为-1
+ */
+int sock_poller_wait(int poller, sock_event_t *events, int max_events, int timeout_ms) {
+    if (poller < 0 || poller >= SOCK_POLLER_NUM || !sock_poller_table[poller].used || max_events <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint64_t deadline = time_now_ms() + (timeout_ms > 0 ? timeout_ms : 0);
+    for (;;) {
+        net_poll();
+        int n = sock_poller_collect(&sock_poller_table[poller], events, max_events);
+        if (n || timeout_ms == 0 || (timeout_ms > 0 && time_now_ms() >= deadline))
+            return n;
+    }
+}
+
+/**
+ * @brief 关闭多路复用器，注册的套接字自动取消注册
+ *
+ * @param poller    多路复用器描述符
+ */
+void sock_poller_close(int poller) {
+    if (poller < 0 || poller >= SOCK_POLLER_NUM || !sock_poller_table[poller].used)
+        return;
+    for (int fd = 0; fd < SOCK_MAX_NUM; fd++) {
+        if (sock_table[fd].type != SOCK_TYPE_FREE && sock_table[fd].poller == poller) {
+            sock_unready(fd);
+            sock_table[fd].poller = -1;
+        }
+    }
+    sock_poller_table[poller].used = 0;
+}
@@ -5,17 +5,98 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
 
 /**
  * @brief TCP 处理程序表
  *
  */
-map_t tcp_handler_table;  // dst-port -> handler
+map_t tcp_handler_table;  // dst-port -> listener
 /**
- * @brief TCP 连接表
+ * @brief TCP 连接池及其空闲链表。连接池按块扩充，块分配后不释放，
+ *        交给处理程序的连接指针在连接释放前一直有效
  *
  */
-static map_t tcp_conn_table;  // [src_ip, src_port, dst_port] -> tcp_conn
+static tcp_conn_t *tcp_conn_chunk[TCP_MAX_CONN_NUM / TCP_CONN_CHUNK_NUM];
+static size_t tcp_conn_chunk_num;
+_Static_assert(TCP_MAX_CONN_NUM % TCP_CONN_CHUNK_NUM == 0, "TCP_MAX_CONN_NUM must be a multiple of TCP_CONN_CHUNK_NUM");
+_Static_assert(offsetof(tcp_conn_t, listener) == CACHE_LINE_SIZE, "tcp_conn_t hot fields exceed one cache line");
+_Static_assert(offsetof(tcp_conn_t, mss) <= 3 * CACHE_LINE_SIZE, "tcp_conn_t warm fields exceed two cache lines");
+static tcp_conn_t *tcp_conn_free;
+static size_t tcp_conn_num;
+/**
+ * @brief TCP 连接表，按四元组哈希，同一桶中的连接通过 hash_next 串成链表
+ *
+ */
+static tcp_conn_t *tcp_conn_table[TCP_CONN_HASH_SIZE];  // [src_ip, dst_ip, src_port, dst_port] -> tcp_conn
+static uint32_t tcp_conn_secret;
+/**
+ * @brief TIME_WAIT 表，与连接表一样按四元组哈希。表项按到期时间串成链表，
+ *        2MSL 相同，新表项和被刷新的表项总是加在队尾，定时器只检查队首
+ *
+ */
+static tcp_timewait_t tcp_timewait_pool[TCP_TIMEWAIT_MAX_NUM];
+static tcp_timewait_t *tcp_timewait_free;
+static tcp_timewait_t *tcp_timewait_table[TCP_TIMEWAIT_HASH_SIZE];  // [src_ip, dst_ip, src_port, dst_port] -> tcp_timewait
+static tcp_timewait_t *tcp_timewait_head;
+static tcp_timewait_t *tcp_timewait_tail;
+static size_t tcp_timewait_num;
+/**
+ * @brief 半连接表，握手完成后表项转为连接表中的完整连接。重传次数相同的半连接超时时间相同，
+ *        每个重传次数一个按到期时间排序的链表，定时器只检查各链表的队首
+ *
+ */
+static tcp_synrecv_t tcp_synrecv_pool[TCP_SYNRECV_MAX_NUM];
+static tcp_synrecv_t *tcp_synrecv_free;
+static tcp_synrecv_t *tcp_synrecv_table[TCP_CONN_HASH_SIZE];  // [src_ip, dst_ip, src_port, dst_port] -> tcp_synrecv
+static tcp_synrecv_t *tcp_synrecv_head[TCP_SYN_RETRIES + 1];
+static tcp_synrecv_t *tcp_synrecv_tail[TCP_SYN_RETRIES + 1];
+static size_t tcp_synrecv_num;
+/**
+ * @brief 发送数据报文段使用的缓冲区
+ *
+ */
+static buf_t tcp_seg_buf;
+/**
+ * @brief 乱序队列节点池及其空闲链表
+ *
+ */
+static tcp_ooo_seg_t tcp_ooo_pool[TCP_OOO_POOL_NUM];
+static tcp_ooo_seg_t *tcp_ooo_free;
+/**
+ * @brief 本次定时器检查的时间（毫秒）
+ *
+ */
+static uint64_t tcp_now;
+/**
+ * @brief 本轮收包结束后需要发送 ACK 或数据的连接
+ *
+ */
+static tcp_key_t tcp_defer_queue[TCP_DEFER_QUEUE_LEN];
+static size_t tcp_defer_queue_len;
+/**
+ * @brief 最近一次在连接表中找到的连接，同一连接的连续报文段不必再计算哈希
+ *
+ */
+static tcp_conn_t *tcp_conn_cache;
+/**
+ * @brief 新连接使用的拥塞控制算法
+ *
+ */
+static const tcp_cc_ops_t *tcp_cc_default;
+/**
+ * @brief 临时端口分配使用的密钥和递增计数（RFC 6056 算法 3）
+ *
+ */
+static uint32_t tcp_port_secret;
+static uint16_t tcp_port_next;
+/**
+ * @brief SYN cookie 使用的密钥，以及 cookie 中 3 位编码能表示的 MSS
+ *
+ */
+static uint32_t tcp_cookie_secret;
+static const uint16_t tcp_cookie_mss[] = {536, 1024, 1300, 1400, 1440, 1460, 4312, 8960};
 
 /* =============================== TOOLS =============================== */
 
@@ -40,7 +121,11 @@ size_t bytes_in_flight(size_t len, uint8_t flags) {
  *
  */
 static inline uint32_t tcp_generate_initial_seq() {
+#ifdef TEST
+    return 1108428113;  // 测试数据按该初始序列号录制，对端的确认号依赖于它
+#else
     return rand() % UINT32_MAX;
+#endif
 }
 
 /**
@@ -52,92 +137,1577 @@ void tcp_rst(tcp_conn_t *tcp_conn) {
 }
 
 /**
- * @brief 生成标识一个 TCP 连接的三元组键
+ * @brief 生成标识一个 TCP 连接的四元组键
  *
- * @param ip        源 IP 地址
- * @param src_port  源端口号
- * @param dst_port  目标端口号
+ * @param host_ip       本端 IP 地址
+ * @param remote_ip     对端 IP 地址
+ * @param remote_port   对端端口号
+ * @param host_port     本端端口号
  * @return tcp_key_t
  */
-static inline tcp_key_t generate_tcp_key(uint8_t remote_ip[NET_IP_LEN], uint16_t remote_port, uint16_t host_port) {
+static inline tcp_key_t generate_tcp_key(const uint8_t host_ip[NET_IP_LEN], const uint8_t remote_ip[NET_IP_LEN], uint16_t remote_port, uint16_t host_port) {
     tcp_key_t key;
     memcpy(key.remote_ip, remote_ip, NET_IP_LEN);
+    memcpy(key.host_ip, host_ip, NET_IP_LEN);
     key.remote_port = remote_port;
     key.host_port = host_port;
     return key;
 }
 
 /**
- * @brief 根据指定的 IP 和端口信息查找或创建 TCP 连接
- *
- * @param remote_ip
- * @param remote_port
- * @param host_port
- * @param create_if_missing 若为 1，则在未找到连接时创建新的 TCP 连接；若为 0，则仅查找
+ * @brief 计算四元组在连接表、半连接表或 TIME_WAIT 表中的哈希桶，混入随机密钥使对端无法构造大量冲突的表项
+ *
+ * @param key       连接的四元组
+ * @param size      哈希桶数，须为2的幂
+ * @return size_t   哈希桶序号
+ */
+static inline size_t tcp_key_hash(const tcp_key_t *key, size_t size) {
+    const uint8_t *p = (const uint8_t *)key;
+    uint32_t hash = 2166136261u ^ tcp_conn_secret;  // FNV-1a
+    for (size_t i = 0; i < sizeof(tcp_key_t); i++)
+        hash = (hash ^ p[i]) * 16777619u;
+    return (hash ^ (hash >> 16)) & (size - 1);
+}
+
+/**
+ * @brief 在连接表中查找连接，同一连接的连续报文段命中最近一次查找的结果，不必计算哈希
+ *
+ * @param key           连接的四元组
+ * @return tcp_conn_t*  找不到为NULL
+ */
+static tcp_conn_t *tcp_conn_lookup(const tcp_key_t *key) {
+    if (tcp_conn_cache && !memcmp(&tcp_conn_cache->key, key, sizeof(tcp_key_t)))
+        return tcp_conn_cache;
+    for (tcp_conn_t *tcp_conn = tcp_conn_table[tcp_key_hash(key, TCP_CONN_HASH_SIZE)]; tcp_conn; tcp_conn = tcp_conn->hash_next) {
+        if (!memcmp(&tcp_conn->key, key, sizeof(tcp_key_t))) {
+            tcp_conn_cache = tcp_conn;
+            return tcp_conn;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief 为连接池分配一个新块，块中的连接按地址顺序加入空闲链表
+ *
+ * @return int  成功为0，连接池已达上限或内存不足时为-1
+ */
+static int tcp_conn_grow() {
+    if (tcp_conn_chunk_num == TCP_MAX_CONN_NUM / TCP_CONN_CHUNK_NUM)
+        return -1;
+    tcp_conn_t *chunk = malloc(sizeof(tcp_conn_t) * TCP_CONN_CHUNK_NUM);
+    if (chunk == NULL)
+        return -1;
+    for (size_t i = TCP_CONN_CHUNK_NUM; i-- > 0;) {  // 从块首开始分配，遍历时活跃连接较为集中
+        chunk[i].state = TCP_STATE_CLOSED;
+        chunk[i].hash_next = tcp_conn_free;
+        tcp_conn_free = &chunk[i];
+    }
+    tcp_conn_chunk[tcp_conn_chunk_num++] = chunk;
+    return 0;
+}
+
+/**
+ * @brief 从连接池中分配一个连接，复制初始状态后按 key 加入连接表
+ *
+ * @param init          连接的初始状态，其中的 key 不能已在连接表中
+ * @return tcp_conn_t*  连接池已满或无法扩充时为NULL
+ */
+static tcp_conn_t *tcp_conn_insert(const tcp_conn_t *init) {
+    if (tcp_conn_free == NULL && tcp_conn_grow() < 0)
+        return NULL;
+    tcp_conn_t *tcp_conn = tcp_conn_free;
+    tcp_conn_free = tcp_conn->hash_next;
+    *tcp_conn = *init;
+    tcp_conn_t **bucket = &tcp_conn_table[tcp_key_hash(&tcp_conn->key, TCP_CONN_HASH_SIZE)];
+    tcp_conn->hash_next = *bucket;
+    *bucket = tcp_conn;
+    tcp_conn_num++;
+    tcp_listener_t *listener = map_get(&tcp_handler_table, &tcp_conn->key.host_port);
+    if (listener)
+        listener->conn_num++;
+    return tcp_conn;
+}
+
+/**
+ * @brief 按连接池中的顺序遍历所有连接，回调中可以释放当前连接
+ *
+ * @param handler   对每个连接调用的回调函数
+ */
+static void tcp_conn_foreach(void (*handler)(tcp_conn_t *tcp_conn)) {
+    size_t left = tcp_conn_num;
+    for (size_t i = 0; i < tcp_conn_chunk_num * TCP_CONN_CHUNK_NUM && left; i++) {
+        tcp_conn_t *tcp_conn = &tcp_conn_chunk[i / TCP_CONN_CHUNK_NUM][i % TCP_CONN_CHUNK_NUM];
+        if (tcp_conn->state != TCP_STATE_CLOSED) {
+            left--;
+            handler(tcp_conn);
+        }
+    }
+}
+
+/**
+ * @brief 通知端口上注册的处理程序连接状态的变化
+ *
+ * @param tcp_conn  TCP 连接
+ * @param events    发生的事件（TCP_EVENT_*）
+ */
+static inline void tcp_notify(tcp_conn_t *tcp_conn, uint8_t events) {
+    if (tcp_conn->listener && tcp_conn->listener->notify)
+        tcp_conn->listener->notify(tcp_conn, events);
+}
+
+/**
+ * @brief 释放 TCP 连接占用的发送缓冲区、接收缓冲区、乱序队列和临时端口，并把连接从连接表归还连接池
+ *
+ * @param tcp_conn  TCP 连接，调用后不再有效
+ */
+static void tcp_free_connection(tcp_conn_t *tcp_conn) {
+    tcp_notify(tcp_conn, TCP_EVENT_CLOSE);
+    if (tcp_conn_cache == tcp_conn)
+        tcp_conn_cache = NULL;
+    tcp_conn_t **link = &tcp_conn_table[tcp_key_hash(&tcp_conn->key, TCP_CONN_HASH_SIZE)];
+    while (*link != tcp_conn)
+        link = &(*link)->hash_next;
+    *link = tcp_conn->hash_next;
+    tcp_conn->state = TCP_STATE_CLOSED;
+    tcp_conn->hash_next = tcp_conn_free;
+    tcp_conn_free = tcp_conn;
+    tcp_conn_num--;
+    tcp_listener_t *listener = map_get(&tcp_handler_table, &tcp_conn->key.host_port);
+    if (listener && listener->conn_num)
+        listener->conn_num--;
+    if (listener && listener->active) {  // 释放主动打开连接占用的临时端口
+        map_delete(&tcp_handler_table, &tcp_conn->key.host_port);
+    } else if (listener && listener->closed && listener->conn_num == 0) {  // 已停止监听的端口上最后一个连接
+        map_delete(&tcp_handler_table, &tcp_conn->key.host_port);
+        net_port_close(NET_PROTOCOL_TCP, tcp_conn->key.host_port);
+    }
+    free(tcp_conn->snd_buf);
+    tcp_conn->snd_buf = NULL;
+    free(tcp_conn->rcv_buf);
+    tcp_conn->rcv_buf = NULL;
+    while (tcp_conn->ooo_head) {
+        tcp_ooo_seg_t *seg = tcp_conn->ooo_head;
+        tcp_conn->ooo_head = seg->next;
+        seg->next = tcp_ooo_free;
+        tcp_ooo_free = seg;
+    }
+    tcp_conn->ooo_bytes = 0;
+}
+
+/**
+ * @brief 在 TIME_WAIT 表中查找四元组
+ *
+ * @param key               连接的四元组
+ * @return tcp_timewait_t*  找不到为NULL
+ */
+static tcp_timewait_t *tcp_timewait_lookup(const tcp_key_t *key) {
+    for (tcp_timewait_t *tw = tcp_timewait_table[tcp_key_hash(key, TCP_TIMEWAIT_HASH_SIZE)]; tw; tw = tw->hash_next)
+        if (!memcmp(&tw->key, key, sizeof(tcp_key_t)))
+            return tw;
+    return NULL;
+}
+
+/**
+ * @brief 把 TIME_WAIT 表项加到到期链表的队尾
+ *
+ */
+static void tcp_timewait_append(tcp_timewait_t *tw) {
+    tw->timer_next = NULL;
+    tw->timer_prev = tcp_timewait_tail;
+    if (tcp_timewait_tail)
+        tcp_timewait_tail->timer_next = tw;
+    else
+        tcp_timewait_head = tw;
+    tcp_timewait_tail = tw;
+}
+
+static void tcp_timewait_unlink(tcp_timewait_t *tw) {
+    if (tw->timer_prev)
+        tw->timer_prev->timer_next = tw->timer_next;
+    else
+        tcp_timewait_head = tw->timer_next;
+    if (tw->timer_next)
+        tw->timer_next->timer_prev = tw->timer_prev;
+    else
+        tcp_timewait_tail = tw->timer_prev;
+}
+
+/**
+ * @brief 移除一个 TIME_WAIT 表项，归还表项池
+ *
+ * @param tw    TIME_WAIT 表项
+ */
+static void tcp_timewait_remove(tcp_timewait_t *tw) {
+    tcp_timewait_t **link = &tcp_timewait_table[tcp_key_hash(&tw->key, TCP_TIMEWAIT_HASH_SIZE)];
+    while (*link != tw)
+        link = &(*link)->hash_next;
+    *link = tw->hash_next;
+    tcp_timewait_unlink(tw);
+    tw->hash_next = tcp_timewait_free;
+    tcp_timewait_free = tw;
+    tcp_timewait_num--;
+}
+
+/**
+ * @brief 在半连接表中查找四元组
+ *
+ * @param key               连接的四元组
+ * @return tcp_synrecv_t*   找不到为NULL
+ */
+static tcp_synrecv_t *tcp_synrecv_lookup(const tcp_key_t *key) {
+    for (tcp_synrecv_t *req = tcp_synrecv_table[tcp_key_hash(key, TCP_CONN_HASH_SIZE)]; req; req = req->hash_next)
+        if (!memcmp(&req->key, key, sizeof(tcp_key_t)))
+            return req;
+    return NULL;
+}
+
+/**
+ * @brief 把半连接加到与其重传次数对应的到期链表的队尾
+ *
+ */
+static void tcp_synrecv_append(tcp_synrecv_t *req) {
+    uint8_t level = req->retries;
+    req->timer_next = NULL;
+    req->timer_prev = tcp_synrecv_tail[level];
+    if (tcp_synrecv_tail[level])
+        tcp_synrecv_tail[level]->timer_next = req;
+    else
+        tcp_synrecv_head[level] = req;
+    tcp_synrecv_tail[level] = req;
+}
+
+static void tcp_synrecv_unlink(tcp_synrecv_t *req) {
+    uint8_t level = req->retries;
+    if (req->timer_prev)
+        req->timer_prev->timer_next = req->timer_next;
+    else
+        tcp_synrecv_head[level] = req->timer_next;
+    if (req->timer_next)
+        req->timer_next->timer_prev = req->timer_prev;
+    else
+        tcp_synrecv_tail[level] = req->timer_prev;
+}
+
+/**
+ * @brief 从半连接池中分配一个半连接，复制初始状态后加入半连接表和到期链表
+ *
+ * @param init              半连接的初始状态，其中的 key 不能已在半连接表中
+ * @return tcp_synrecv_t*   半连接池已满时为NULL
+ */
+static tcp_synrecv_t *tcp_synrecv_insert(const tcp_synrecv_t *init) {
+    tcp_synrecv_t *req = tcp_synrecv_free;
+    if (req == NULL)
+        return NULL;
+    tcp_synrecv_free = req->hash_next;
+    *req = *init;
+    tcp_synrecv_t **bucket = &tcp_synrecv_table[tcp_key_hash(&req->key, TCP_CONN_HASH_SIZE)];
+    req->hash_next = *bucket;
+    *bucket = req;
+    tcp_synrecv_append(req);
+    tcp_synrecv_num++;
+    return req;
+}
+
+/**
+ * @brief 从发送缓冲区中复制数据
+ *
+ * @param tcp_conn  TCP 连接
+ * @param offset    相对最早未确认数据的偏移
+ * @param dst       目标地址
+ * @param len       复制长度
+ */
+static void tcp_sndbuf_read(tcp_conn_t *tcp_conn, size_t offset, uint8_t *dst, size_t len) {
+    if (len == 0)
+        return;
+    size_t pos = (tcp_conn->snd_head + offset) % tcp_conn->snd_size;
+    size_t first = tcp_conn->snd_size - pos < len ? tcp_conn->snd_size - pos : len;
+    memcpy(dst, tcp_conn->snd_buf + pos, first);
+    memcpy(dst + first, tcp_conn->snd_buf, len - first);
+}
+
+/**
+ * @brief 向发送缓冲区追加数据，容量不足时倍增，直至达到上限
+ *
+ * @param tcp_conn  TCP 连接
+ * @param data      要追加的数据
+ * @param len       数据长度
+ * @return size_t   实际追加的长度
+ */
+static size_t tcp_sndbuf_write(tcp_conn_t *tcp_conn, const uint8_t *data, size_t len) {
+    size_t need = tcp_conn->snd_len + len;
+    if (need > tcp_conn->snd_size && tcp_conn->snd_size < TCP_SEND_BUFFER_MAX_SIZE) {
+        size_t size = tcp_conn->snd_size ? tcp_conn->snd_size : TCP_SEND_BUFFER_SIZE;
+        while (size < need && size < TCP_SEND_BUFFER_MAX_SIZE)
+            size *= 2;
+        if (size > TCP_SEND_BUFFER_MAX_SIZE)
+            size = TCP_SEND_BUFFER_MAX_SIZE;
+        uint8_t *snd_buf = malloc(size);
+        if (snd_buf) {  // 扩容时将环形缓冲区中的数据整理到新缓冲区开头
+            if (tcp_conn->snd_buf)
+                tcp_sndbuf_read(tcp_conn, 0, snd_buf, tcp_conn->snd_len);
+            free(tcp_conn->snd_buf);
+            tcp_conn->snd_buf = snd_buf;
+            tcp_conn->snd_size = size;
+            tcp_conn->snd_head = 0;
+        }
+    }
+    if (len > tcp_conn->snd_size - tcp_conn->snd_len)
+        len = tcp_conn->snd_size - tcp_conn->snd_len;
+    if (len == 0)
+        return 0;
+    size_t tail = (tcp_conn->snd_head + tcp_conn->snd_len) % tcp_conn->snd_size;
+    size_t first = tcp_conn->snd_size - tail < len ? tcp_conn->snd_size - tail : len;
+    memcpy(tcp_conn->snd_buf + tail, data, first);
+    memcpy(tcp_conn->snd_buf, data + first, len - first);
+    tcp_conn->snd_len += len;
+    return len;
+}
+
+/**
+ * @brief 释放发送缓冲区中已被确认的数据
+ *
+ * @param tcp_conn  TCP 连接
+ * @param len       已确认的数据长度
+ */
+static void tcp_sndbuf_consume(tcp_conn_t *tcp_conn, size_t len) {
+    tcp_conn->snd_len -= len;
+    tcp_conn->snd_head = tcp_conn->snd_len ? (tcp_conn->snd_head + len) % tcp_conn->snd_size : 0;
+}
+
+/**
+ * @brief 从接收缓冲区开头复制数据
+ *
+ * @param tcp_conn  TCP 连接
+ * @param dst       目标地址
+ * @param len       复制长度
+ */
+static void tcp_rcvbuf_copy(tcp_conn_t *tcp_conn, uint8_t *dst, size_t len) {
+    if (len == 0)
+        return;
+    size_t first = tcp_conn->rcv_size - tcp_conn->rcv_head < len ? tcp_conn->rcv_size - tcp_conn->rcv_head : len;
+    memcpy(dst, tcp_conn->rcv_buf + tcp_conn->rcv_head, first);
+    memcpy(dst + first, tcp_conn->rcv_buf, len - first);
+}
+
+/**
+ * @brief 调整接收缓冲区容量，已分配时将未读数据整理到新缓冲区开头
+ *
+ * @param tcp_conn  TCP 连接
+ * @param size      新的容量，不小于当前容量
+ */
+static void tcp_rcvbuf_resize(tcp_conn_t *tcp_conn, size_t size) {
+    if (tcp_conn->rcv_buf) {
+        uint8_t *rcv_buf = malloc(size);
+        if (rcv_buf == NULL)
+            return;
+        tcp_rcvbuf_copy(tcp_conn, rcv_buf, tcp_conn->rcv_len);
+        free(tcp_conn->rcv_buf);
+        tcp_conn->rcv_buf = rcv_buf;
+        tcp_conn->rcv_head = 0;
+    }
+    tcp_conn->rcv_size = size;
+}
+
+/**
+ * @brief 向接收缓冲区追加按序到达的数据，通告的窗口保证有足够的空间
+ *
+ * @param tcp_conn  TCP 连接
+ * @param data      数据
+ * @param len       数据长度
+ */
+static void tcp_rcvbuf_write(tcp_conn_t *tcp_conn, const uint8_t *data, size_t len) {
+    if (tcp_conn->rcv_buf == NULL && (tcp_conn->rcv_buf = malloc(tcp_conn->rcv_size)) == NULL)
+        return;
+    if (len > tcp_conn->rcv_size - tcp_conn->rcv_len)
+        len = tcp_conn->rcv_size - tcp_conn->rcv_len;
+    size_t tail = (tcp_conn->rcv_head + tcp_conn->rcv_len) % tcp_conn->rcv_size;
+    size_t first = tcp_conn->rcv_size - tail < len ? tcp_conn->rcv_size - tail : len;
+    memcpy(tcp_conn->rcv_buf + tail, data, first);
+    memcpy(tcp_conn->rcv_buf, data + first, len - first);
+    tcp_conn->rcv_len += len;
+}
+
+/**
+ * @brief 计算要通告的接收窗口：缓冲区剩余空间，但增加不足 min(缓冲区的一半, MSS) 时保持原右边界，
+ *        避免通告过小的窗口（接收方 SWS 避免，RFC 1122 4.2.3.3）
+ *
+ * @param tcp_conn  TCP 连接
+ * @return uint32_t 窗口大小（未按扩大因子缩小）
+ */
+static uint32_t tcp_rcv_window(tcp_conn_t *tcp_conn) {
+    uint32_t space = tcp_conn->rcv_size - tcp_conn->rcv_len;
+    uint32_t cur = TCP_SEQ_GT(tcp_conn->rcv_adv, tcp_conn->ack) ? tcp_conn->rcv_adv - tcp_conn->ack : 0;
+    uint32_t threshold = tcp_conn->rcv_size / 2 < tcp_conn->smss ? tcp_conn->rcv_size / 2 : tcp_conn->smss;
+    return space < cur + threshold ? cur : space;
+}
+
+/**
+ * @brief 每个 RTT 统计一次按序收到的数据量，接收缓冲区小于其两倍时倍增，
+ *        使通告的窗口不成为高 BDP 链路上的瓶颈
+ *
+ * @param tcp_conn  TCP 连接
+ */
+static void tcp_rcvbuf_autotune(tcp_conn_t *tcp_conn) {
+    uint64_t now = time_now_ms();
+    uint32_t rtt = tcp_conn->srtt ? tcp_conn->srtt : TCP_RCVBUF_RTT_MS;
+    if (tcp_conn->rcv_space_time == 0) {
+        tcp_conn->rcv_space_seq = tcp_conn->ack;
+        tcp_conn->rcv_space_time = now;
+        return;
+    }
+    if (now - tcp_conn->rcv_space_time < rtt)
+        return;
+    size_t target = 2 * (size_t)(tcp_conn->ack - tcp_conn->rcv_space_seq);
+    if (target > tcp_conn->rcv_size && tcp_conn->rcv_size < TCP_RECV_BUFFER_MAX_SIZE) {
+        size_t size = tcp_conn->rcv_size;
+        while (size < target && size < TCP_RECV_BUFFER_MAX_SIZE)
+            size *= 2;
+        tcp_rcvbuf_resize(tcp_conn, size < TCP_RECV_BUFFER_MAX_SIZE ? size : TCP_RECV_BUFFER_MAX_SIZE);
+    }
+    tcp_conn->rcv_space_seq = tcp_conn->ack;
+    tcp_conn->rcv_space_time = now;
+}
+
+/**
+ * @brief 把按序到达的数据交给应用：直接交付给处理程序，或写入接收缓冲区等待 tcp_read() 读取
+ *
+ * @param tcp_conn  TCP 连接
+ * @param listener  端口上注册的处理程序
+ * @param data      数据
+ * @param len       数据长度
+ */
+static void tcp_deliver(tcp_conn_t *tcp_conn, tcp_listener_t *listener, uint8_t *data, size_t len) {
+    if (listener->buffered)
+        tcp_rcvbuf_write(tcp_conn, data, len);
+    else
+        listener->handler(tcp_conn, data, len, tcp_conn->key.remote_ip, tcp_conn->key.remote_port);
+}
+
+/**
+ * @brief 将超前于期望序列号的数据放入乱序队列，与已缓存数据重叠的部分丢弃
+ *
+ * @param tcp_conn  TCP 连接
+ * @param seq       数据的序列号
+ * @param data      数据
+ * @param len       数据长度
+ * @param fin       报文段是否携带 FIN
+ */
+static void tcp_ooo_insert(tcp_conn_t *tcp_conn, uint32_t seq, uint8_t *data, size_t len, uint8_t fin) {
+    uint32_t end = seq + len;
+    if (TCP_SEQ_GT(end, tcp_conn->rcv_adv))  // 超出通告窗口
+        return;
+    tcp_ooo_seg_t **link = &tcp_conn->ooo_head;
+    while (TCP_SEQ_LT(seq, end)) {
+        while (*link && TCP_SEQ_LEQ((*link)->seq + (*link)->len, seq))
+            link = &(*link)->next;
+        tcp_ooo_seg_t *next = *link;
+        if (next && TCP_SEQ_LEQ(next->seq, seq)) {  // 跳过已缓存的部分
+            uint32_t skip = next->seq + next->len - seq;
+            if (skip > end - seq)
+                skip = end - seq;
+            seq += skip, data += skip;
+            continue;
+        }
+        uint32_t piece = (next && TCP_SEQ_LT(next->seq, end) ? next->seq : end) - seq;
+        if (piece > TCP_OOO_SEG_SIZE)
+            piece = TCP_OOO_SEG_SIZE;
+        if (tcp_conn->ooo_bytes + piece > tcp_conn->rcv_size || !tcp_ooo_free)  // 缓存已满，剩余数据等待对端重传
+            return;
+        tcp_ooo_seg_t *seg = tcp_ooo_free;
+        tcp_ooo_free = seg->next;
+        seg->seq = seq;
+        seg->len = piece;
+        seg->fin = 0;
+        memcpy(seg->data, data, piece);
+        seg->next = next;
+        *link = seg;
+        link = &seg->next;
+        tcp_conn->ooo_bytes += piece;
+        seq += piece, data += piece;
+    }
+    // 整个报文段都已缓存时才记录 FIN，否则等待对端重传
+    if (fin && seq == end) {
+        tcp_ooo_seg_t *seg = tcp_conn->ooo_head;
+        while (seg && seg->seq + seg->len != end)
+            seg = seg->next;
+        if (seg)
+            seg->fin = 1;
+    }
+}
+
+/**
+ * @brief 缺口填上后，按序交付乱序队列中与已接收数据相连的部分并推进确认号
+ *
+ * @param tcp_conn  TCP 连接
+ * @param listener  端口上注册的处理程序
+ * @return int      交付的数据之后是否有 FIN
+ */
+static int tcp_ooo_deliver(tcp_conn_t *tcp_conn, tcp_listener_t *listener) {
+    int fin = 0;
+    while (!fin && tcp_conn->ooo_head && TCP_SEQ_LEQ(tcp_conn->ooo_head->seq, tcp_conn->ack)) {
+        tcp_ooo_seg_t *seg = tcp_conn->ooo_head;
+        uint32_t end = seg->seq + seg->len;
+        if (TCP_SEQ_GT(end, tcp_conn->ack)) {
+            uint32_t offset = tcp_conn->ack - seg->seq;
+            tcp_conn->ack = end;
+            tcp_deliver(tcp_conn, listener, seg->data + offset, seg->len - offset);
+        }
+        if (seg->fin && TCP_SEQ_GEQ(end, tcp_conn->ack)) {
+            tcp_conn->ack += 1;
+            fin = 1;
+        }
+        tcp_conn->ooo_head = seg->next;
+        tcp_conn->ooo_bytes -= seg->len;
+        seg->next = tcp_ooo_free;
+        tcp_ooo_free = seg;
+    }
+    return fin;
+}
+
+/**
+ * @brief 用一个新的 RTT 测量值更新 SRTT、RTTVAR 和 RTO（RFC 6298 第 2 节）
+ *
+ * @param tcp_conn  TCP 连接
+ * @param rtt       测量值（毫秒）
+ */
+static void tcp_rtt_update(tcp_conn_t *tcp_conn, uint32_t rtt) {
+    if (tcp_conn->srtt == 0) {
+        tcp_conn->srtt = rtt ? rtt : 1;
+        tcp_conn->rttvar = rtt / 2;
+    } else {
+        uint32_t delta = tcp_conn->srtt > rtt ? tcp_conn->srtt - rtt : rtt - tcp_conn->srtt;
+        tcp_conn->rttvar = (3 * tcp_conn->rttvar + delta) / 4;
+        tcp_conn->srtt = (7 * tcp_conn->srtt + rtt) / 8;
+    }
+    uint32_t var = 4 * tcp_conn->rttvar > TCP_CLOCK_GRANULARITY_MS ? 4 * tcp_conn->rttvar : TCP_CLOCK_GRANULARITY_MS;
+    uint32_t rto = tcp_conn->srtt + var;
+    tcp_conn->rto = rto < TCP_MIN_RTO_MS ? TCP_MIN_RTO_MS : rto > TCP_MAX_RTO_MS ? TCP_MAX_RTO_MS : rto;
+}
+
+/**
+ * @brief 解析报文段携带的选项
+ *
+ * @param hdr       TCP 报头
+ * @param hdr_len   包含选项的报头长度
+ * @param opts      解析结果，未携带的选项取默认值
+ */
+static void tcp_parse_options(tcp_hdr_t *hdr, size_t hdr_len, tcp_opts_t *opts) {
+    memset(opts, 0, sizeof(tcp_opts_t));
+    opts->mss = TCP_DEFAULT_MSS;
+    opts->wscale = TCP_WSCALE_NONE;
+    uint8_t *opt = (uint8_t *)hdr + sizeof(tcp_hdr_t);
+    uint8_t *end = (uint8_t *)hdr + hdr_len;
+    while (opt < end && *opt != TCP_OPT_END) {
+        if (*opt == TCP_OPT_NOP) {
+            opt++;
+            continue;
+        }
+        if (end - opt < 2 || opt[1] < 2 || opt[1] > end - opt)  // 选项长度非法
+            break;
+        switch (opt[0]) {
+            case TCP_OPT_MSS:
+                if (opt[1] == 4 && ((opt[2] << 8) | opt[3]))
+                    opts->mss = (opt[2] << 8) | opt[3];
+                break;
+            case TCP_OPT_WS:
+                if (opt[1] == 3)
+                    opts->wscale = opt[2] > TCP_MAX_WSCALE ? TCP_MAX_WSCALE : opt[2];
+                break;
+            case TCP_OPT_SACK_PERM:
+                opts->sack_perm = opt[1] == 2;
+                break;
+            case TCP_OPT_TS:
+                if (opt[1] == 10) {
+                    opts->ts = 1;
+                    opts->tsval = swap32(*(uint32_t *)(opt + 2));
+                    opts->tsecr = swap32(*(uint32_t *)(opt + 6));
+                }
+                break;
+            case TCP_OPT_SACK:
+                for (uint8_t *b = opt + 2; b + 8 <= opt + opt[1] && opts->sack_num < TCP_SACK_MAX_BLOCKS; b += 8) {
+                    opts->sack[opts->sack_num].start = swap32(*(uint32_t *)b);
+                    opts->sack[opts->sack_num].end = swap32(*(uint32_t *)(b + 4));
+                    opts->sack_num++;
+                }
+                break;
+            default:
+                break;
+        }
+        opt += opt[1];
+    }
+}
+
+/**
+ * @brief 生成要发送的报文段的选项：SYN 携带 MSS 和对端在 SYN 中提供的选项，
+ *        其余报文段在协商后携带时间戳，不带数据时用 SACK 块告知乱序队列中已收到的数据
+ *
+ * @param tcp_conn  TCP 连接
+ * @param opt       选项写入的位置，至少 TCP_MAX_HEADER_LEN - TCP_HEADER_LEN 字节
+ * @param flags     TCP 标志位
+ * @param data_len  报文段的数据长度
+ * @param mtu       出口网卡的 MTU，用于计算 SYN 中通告的 MSS
+ * @return size_t   选项长度，4 字节对齐
+ */
+static size_t tcp_build_options(tcp_conn_t *tcp_conn, uint8_t *opt, uint8_t flags, size_t data_len, uint16_t mtu) {
+    uint8_t *p = opt;
+    if (TCP_FLG_ISSET(flags, TCP_FLG_SYN)) {
+        uint16_t mss = mtu - sizeof(ip_hdr_t) - sizeof(tcp_hdr_t);
+        *p++ = TCP_OPT_MSS;
+        *p++ = 4;
+        *p++ = mss >> 8;
+        *p++ = mss & 0xff;
+        if (tcp_conn->rcv_wscale) {
+            *p++ = TCP_OPT_NOP;
+            *p++ = TCP_OPT_WS;
+            *p++ = 3;
+            *p++ = tcp_conn->rcv_wscale;
+        }
+        if (tcp_conn->sack_ok) {  // 与时间戳一起时不需要填充
+            if (!tcp_conn->ts_ok) {
+                *p++ = TCP_OPT_NOP;
+                *p++ = TCP_OPT_NOP;
+            }
+            *p++ = TCP_OPT_SACK_PERM;
+            *p++ = 2;
+        }
+    }
+    if (tcp_conn->ts_ok) {
+        if (!TCP_FLG_ISSET(flags, TCP_FLG_SYN) || !tcp_conn->sack_ok) {
+            *p++ = TCP_OPT_NOP;
+            *p++ = TCP_OPT_NOP;
+        }
+        uint32_t tsval = swap32((uint32_t)time_now_ms());
+        uint32_t tsecr = swap32(tcp_conn->ts_recent);
+        *p++ = TCP_OPT_TS;
+        *p++ = 10;
+        memcpy(p, &tsval, 4);
+        memcpy(p + 4, &tsecr, 4);
+        p += 8;
+    }
+    if (tcp_conn->sack_ok && tcp_conn->ooo_head && data_len == 0 && !TCP_FLG_ISSET(flags, TCP_FLG_SYN)) {
+        size_t max = (TCP_MAX_HEADER_LEN - TCP_HEADER_LEN - (p - opt) - 4) / 8;
+        uint8_t *sack = p + 2;
+        p[0] = TCP_OPT_NOP;
+        p[1] = TCP_OPT_NOP;
+        p += 4;
+        // 相邻的乱序队列节点合并为一个 SACK 块
+        for (tcp_ooo_seg_t *seg = tcp_conn->ooo_head; seg && (size_t)(p - sack - 2) / 8 < max;) {
+            uint32_t start = seg->seq, end = seg->seq + seg->len + seg->fin;
+            for (seg = seg->next; seg && seg->seq == end; seg = seg->next)
+                end += seg->len + seg->fin;
+            start = swap32(start);
+            end = swap32(end);
+            memcpy(p, &start, 4);
+            memcpy(p + 4, &end, 4);
+            p += 8;
+        }
+        sack[0] = TCP_OPT_SACK;
+        sack[1] = p - sack;
+    }
+    return p - opt;
+}
+
+/**
+ * @brief 把对端 SACK 的一段数据并入 scoreboard，记录已满时丢弃序列号最大的块
+ *
+ * @param tcp_conn  TCP 连接
+ * @param start     起始序列号
+ * @param end       结束序列号（不含）
+ */
+static void tcp_sack_update(tcp_conn_t *tcp_conn, uint32_t start, uint32_t end) {
+    tcp_sack_block_t *sb = tcp_conn->sacked;
+    size_t n = tcp_conn->sacked_num, i = 0, j;
+    while (i < n && TCP_SEQ_LT(sb[i].end, start))
+        i++;
+    // 与 [start, end) 重叠或相邻的块合并为一个
+    for (j = i; j < n && TCP_SEQ_LEQ(sb[j].start, end); j++) {
+        if (TCP_SEQ_LT(sb[j].start, start))
+            start = sb[j].start;
+        if (TCP_SEQ_GT(sb[j].end, end))
+            end = sb[j].end;
+    }
+    if (i == j) {
+        if (n == TCP_SACK_SCOREBOARD) {
+            if (i == n)
+                return;
+            n--;
+        }
+        memmove(&sb[i + 1], &sb[i], (n - i) * sizeof(tcp_sack_block_t));
+        n++;
+    } else {
+        memmove(&sb[i + 1], &sb[j], (n - j) * sizeof(tcp_sack_block_t));
+        n -= j - i - 1;
+    }
+    sb[i].start = start;
+    sb[i].end = end;
+    tcp_conn->sacked_num = n;
+}
+
+/**
+ * @brief snd_una 前进后，从 scoreboard 中移除已被累积确认的部分
+ *
+ * @param tcp_conn  TCP 连接
+ */
+static void tcp_sack_trim(tcp_conn_t *tcp_conn) {
+    tcp_sack_block_t *sb = tcp_conn->sacked;
+    size_t i = 0;
+    while (i < tcp_conn->sacked_num && TCP_SEQ_LEQ(sb[i].end, tcp_conn->snd_una))
+        i++;
+    memmove(sb, &sb[i], (tcp_conn->sacked_num - i) * sizeof(tcp_sack_block_t));
+    tcp_conn->sacked_num -= i;
+    if (tcp_conn->sacked_num && TCP_SEQ_LT(sb[0].start, tcp_conn->snd_una))
+        sb[0].start = tcp_conn->snd_una;
+}
+
+/**
+ * @brief 计算发往对端的报文段能携带的最大数据长度
+ *
+ * @param tcp_conn  TCP 连接
+ * @param dst_ip    对端 IP 地址
+ * @return size_t   出口网卡 MTU 与对端 MSS 中较小的一个，再减去每个报文段都携带的选项
+ */
+static size_t tcp_send_mss(tcp_conn_t *tcp_conn, uint8_t *dst_ip) {
+    size_t mss = net_if_select(tcp_conn->key.host_ip, dst_ip)->mtu - sizeof(ip_hdr_t) - sizeof(tcp_hdr_t);
+    if (tcp_conn->mss && tcp_conn->mss < mss)
+        mss = tcp_conn->mss;
+    if (tcp_conn->ts_ok)  // MSS 不包括选项（RFC 6691）
+        mss -= TCP_OPT_TS_LEN;
+    return mss;
+}
+
+/**
+ * @brief 主动打开时发送 SYN，被动打开时发送 SYN-ACK
+ *
+ * @param tcp_conn  TCP 连接
+ * @return uint8_t  TCP 标志位
+ */
+static inline uint8_t tcp_syn_flags(tcp_conn_t *tcp_conn) {
+    return tcp_conn->state == TCP_STATE_SYN_SENT ? TCP_FLG_SYN : TCP_FLG_SYN | TCP_FLG_ACK;
+}
+
+/**
+ * @brief 为主动打开的连接分配临时端口（RFC 6056 算法 3）：搜索起点由四元组和密钥的哈希决定，
+ *        发往不同对端的端口序列互不相关且难以猜测，发往同一对端的连接依次后移，不会立即复用刚释放的端口
+ *
+ * @param local_ip      本端 IP 地址
+ * @param remote_ip     对端 IP 地址
+ * @param remote_port   对端端口号
+ * @return uint16_t     端口号，临时端口耗尽时为0
+ */
+static uint16_t tcp_ephemeral_port(uint8_t *local_ip, uint8_t *remote_ip, uint16_t remote_port) {
+    uint8_t tuple[2 * NET_IP_LEN + sizeof(uint16_t)];
+    memcpy(tuple, local_ip, NET_IP_LEN);
+    memcpy(tuple + NET_IP_LEN, remote_ip, NET_IP_LEN);
+    memcpy(tuple + 2 * NET_IP_LEN, &remote_port, sizeof(uint16_t));
+    uint32_t offset = 2166136261u ^ tcp_port_secret;  // FNV-1a
+    for (size_t i = 0; i < sizeof(tuple); i++)
+        offset = (offset ^ tuple[i]) * 16777619u;
+
+    uint32_t num = TCP_EPHEMERAL_PORT_MAX - TCP_EPHEMERAL_PORT_MIN + 1;
+    for (uint32_t i = 0; i < num; i++) {
+        uint16_t port = TCP_EPHEMERAL_PORT_MIN + (offset + tcp_port_next++) % num;
+        tcp_key_t key = generate_tcp_key(local_ip, remote_ip, remote_port, port);
+        // 端口上已有监听或主动打开的连接，或者同一四元组仍处于 TIME_WAIT
+        if (map_get(&tcp_handler_table, &port) || tcp_timewait_lookup(&key))
+            continue;
+        return port;
+    }
+    return 0;
+}
+
+/* =============================== TOOLS =============================== */
+
+/* =============================== COMMON API =============================== */
+
+/**
+ * @brief 填写 TCP 报文头并以指定序列号发送
+ *
+ * @param tcp_conn  指向当前 TCP 连接的指针，用于获取确认号等状态信息
+ * @param buf       数据缓冲区，payload 为要发送的数据
+ * @param seq       报文段的序列号，重传时小于 tcp_conn->snd_max
+ * @param src_ip    本端IP地址，即连接绑定的地址
+ * @param src_port  源端口号
+ * @param dst_ip    目标IP地址
+ * @param dst_port  目标端口号
+ * @param flags     TCP 标志位
+ */
+static void tcp_out_seq(tcp_conn_t *tcp_conn, buf_t *buf, uint32_t seq, uint8_t *src_ip, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port, uint8_t flags) {
+    /* =============================== TODO 1 BEGIN =============================== */
+    /* Step1: 添加 TCP 报头和选项 */
+    uint8_t opts[TCP_MAX_HEADER_LEN - TCP_HEADER_LEN];
+    size_t opts_len = tcp_build_options(tcp_conn, opts, flags, buf->len, net_if_select(src_ip, dst_ip)->mtu);
+    buf_add_header(buf, sizeof(tcp_hdr_t) + opts_len);
+    memcpy(buf->data + sizeof(tcp_hdr_t), opts, opts_len);
+    
+    /* Step2: 填充 TCP 首部字段，SYN 中的窗口不扩大 */
+    tcp_hdr_t *hdr = (tcp_hdr_t *)buf->data;
+    uint8_t wscale = TCP_FLG_ISSET(flags, TCP_FLG_SYN) ? 0 : tcp_conn->rcv_wscale;
+    uint32_t wnd = tcp_rcv_window(tcp_conn) >> wscale;
+    if (wnd > TCP_MAX_WINDOW_SIZE)
+        wnd = TCP_MAX_WINDOW_SIZE;
+    tcp_conn->rcv_adv = tcp_conn->ack + (wnd << wscale);
+    hdr->src_port16 = swap16(src_port);
+    hdr->dst_port16 = swap16(dst_port);
+    hdr->seq = swap32(seq);
+    hdr->ack = swap32(tcp_conn->ack);
+    hdr->doff = ((sizeof(tcp_hdr_t) + opts_len) / 4) << 4;  // 首部长度，高4位表示，以4字节为单位
+    hdr->flags = flags;
+    hdr->win = swap16(wnd);
+    hdr->uptr = 0;                             // urgent pointer 置零
+    
+    /* Step3: 计算并填充校验和 */
+    hdr->checksum16 = 0;
+    hdr->checksum16 = transport_checksum(NET_PROTOCOL_TCP, buf, src_ip, dst_ip);
+    
+    /* Step4: 发送 TCP 数据报 */
+    ip_out_from(buf, src_ip, dst_ip, NET_PROTOCOL_TCP);
+    /* =============================== TODO 1 END =============================== */
+
+    // 每个携带 ACK 的报文段都已将最新的确认号告知对端，不必再单独确认
+    if (TCP_FLG_ISSET(flags, TCP_FLG_ACK)) {
+        tcp_conn->not_send_empty_ack = 1;
+        tcp_conn->rcv_wup = tcp_conn->ack;
+        tcp_conn->deferred &= ~TCP_DEFER_ACK;
+        tcp_conn->delack_expire = 0;
+    }
+}
+
+/**
+ * @brief 填写 TCP 报文头并发送
+ *
+ * @param tcp_conn  指向当前 TCP 连接的指针，用于获取和更新序列号、确认号、窗口大小等状态信息
+ * @param buf       数据缓冲区，payload 为要发送的数据
+ * @param src_port  源端口号
+ * @param dst_ip    目标IP地址
+ * @param dst_port  目标端口号
+ * @param flags     TCP 标志位
+ */
+void tcp_out(tcp_conn_t *tcp_conn, buf_t *buf, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port, uint8_t flags) {
+    tcp_out_seq(tcp_conn, buf, tcp_conn->seq, tcp_conn->key.host_ip, src_port, dst_ip, dst_port, flags);
+}
+
+/**
+ * @brief 发送一个不带数据的 ACK
+ *
+ * @param tcp_conn  TCP 连接
+ */
+static void tcp_send_ack(tcp_conn_t *tcp_conn) {
+    buf_init(&txbuf, 0);
+    tcp_out(tcp_conn, &txbuf, tcp_conn->key.host_port, tcp_conn->key.remote_ip, tcp_conn->key.remote_port, TCP_FLG_ACK);
+}
+
+/**
+ * @brief 从发送缓冲区取出数据组成一个报文段发送
+ *
+ * @param tcp_conn  TCP 连接
+ * @param key       连接的四元组
+ * @param seq       报文段序列号，小于 snd_max 即为重传，重传的报文段不用于测量 RTT（Karn 算法）
+ * @param offset    数据相对最早未确认数据的偏移
+ * @param len       数据长度
+ * @param flags     TCP 标志位
+ */
+static void tcp_xmit(tcp_conn_t *tcp_conn, tcp_key_t *key, uint32_t seq, size_t offset, size_t len, uint8_t flags) {
+    buf_init(&tcp_seg_buf, len);
+    tcp_sndbuf_read(tcp_conn, offset, tcp_seg_buf.data, len);
+    tcp_out_seq(tcp_conn, &tcp_seg_buf, seq, key->host_ip, key->host_port, key->remote_ip, key->remote_port, flags);
+
+    uint32_t end = seq + bytes_in_flight(len, flags);
+    if (TCP_SEQ_LT(seq, tcp_conn->snd_max))
+        tcp_conn->rtt_start = 0;
+    else if (tcp_conn->rtt_start == 0) {  // 同一时间只测量一个报文段
+        tcp_conn->rtt_seq = end;
+        tcp_conn->rtt_start = time_now_ms();
+    }
+    if (TCP_SEQ_GT(end, tcp_conn->snd_max))
+        tcp_conn->snd_max = end;
+    if (tcp_conn->rto_expire == 0)
+        tcp_conn->rto_expire = time_now_ms() + tcp_conn->rto;
+}
+
+/**
+ * @brief 在对端窗口和拥塞窗口允许的范围内发送缓冲区中尚未发送的 SYN、数据和 FIN
+ *
+ * @param tcp_conn  TCP 连接
+ * @param key       连接的四元组
+ * @param push      为 true 时不足 MSS 的数据也立即发送，不受 Nagle 算法限制
+ */
+static void tcp_output(tcp_conn_t *tcp_conn, tcp_key_t *key, bool push) {
+    if (tcp_conn->snd_ctl & TCP_FLG_SYN) {  // SYN 被确认之前不发送数据
+        if (tcp_conn->seq == tcp_conn->snd_una) {
+            tcp_xmit(tcp_conn, key, tcp_conn->seq, 0, 0, tcp_syn_flags(tcp_conn));
+            tcp_conn->seq += 1;
+        }
+        return;
+    }
+
+    size_t mss = tcp_send_mss(tcp_conn, key->remote_ip);
+    tcp_conn->smss = mss;
+    uint32_t wnd = tcp_conn->snd_wnd < tcp_conn->cwnd ? tcp_conn->snd_wnd : tcp_conn->cwnd;
+    uint32_t wnd_end = tcp_conn->snd_una + wnd;
+    size_t sent;
+    while ((sent = tcp_conn->seq - tcp_conn->snd_una) < tcp_conn->snd_len && TCP_SEQ_LT(tcp_conn->seq, wnd_end)) {
+        size_t len = tcp_conn->snd_len - sent;
+        if (len > mss)
+            len = mss;
+        if (len > wnd_end - tcp_conn->seq)
+            len = wnd_end - tcp_conn->seq;
+        uint8_t flags = TCP_FLG_ACK;
+        if (sent + len == tcp_conn->snd_len)  // 缓冲区中的最后一段，FIN 可以顺带发送
+            flags |= TCP_FLG_PSH | (tcp_conn->snd_ctl & TCP_FLG_FIN);
+        // Nagle 算法（Minshall 变体）：之前的小报文段尚未被确认时，不足 MSS 的数据留待与后续写入合并
+        if (len < mss && !push && !(flags & TCP_FLG_FIN) && TCP_SEQ_GT(tcp_conn->snd_sml, tcp_conn->snd_una))
+            break;
+        tcp_xmit(tcp_conn, key, tcp_conn->seq, sent, len, flags);
+        tcp_conn->seq += bytes_in_flight(len, flags);
+        if (len < mss)
+            tcp_conn->snd_sml = tcp_conn->seq;
+    }
+    if ((tcp_conn->snd_ctl & TCP_FLG_FIN) && tcp_conn->seq == tcp_conn->snd_una + tcp_conn->snd_len) {
+        tcp_xmit(tcp_conn, key, tcp_conn->seq, tcp_conn->snd_len, 0, TCP_FLG_FIN | TCP_FLG_ACK);
+        tcp_conn->seq += 1;
+    }
+    if (tcp_conn->snd_len && tcp_conn->rto_expire == 0)  // 窗口关闭时由定时器发送零窗口探测
+        tcp_conn->rto_expire = time_now_ms() + tcp_conn->rto;
+}
+
+/**
+ * @brief 推迟到本轮收包结束后再发送 ACK 或数据，同一轮中的多次请求合并为一次，队列已满时立即处理
+ *
+ * @param tcp_conn  TCP 连接
+ * @param what      TCP_DEFER_ACK 或 TCP_DEFER_OUTPUT
+ */
+static void tcp_defer(tcp_conn_t *tcp_conn, uint8_t what) {
+    if (tcp_conn->deferred == 0) {
+        if (tcp_defer_queue_len == TCP_DEFER_QUEUE_LEN) {
+            if (what & TCP_DEFER_OUTPUT)
+                tcp_output(tcp_conn, &tcp_conn->key, false);
+            if ((what & TCP_DEFER_ACK) && !tcp_conn->not_send_empty_ack)
+                tcp_send_ack(tcp_conn);
+            return;
+        }
+        tcp_defer_queue[tcp_defer_queue_len++] = tcp_conn->key;
+    }
+    tcp_conn->deferred |= what;
+}
+
+/**
+ * @brief 处理本轮收包中推迟的工作：先发送数据，仍需确认时再单独发送 ACK
+ *
+ */
+static void tcp_defer_flush() {
+    for (size_t i = 0; i < tcp_defer_queue_len; i++) {
+        tcp_conn_t *tcp_conn = tcp_conn_lookup(&tcp_defer_queue[i]);
+        if (tcp_conn == NULL)
+            continue;
+        if (tcp_conn->deferred & TCP_DEFER_OUTPUT)
+            tcp_output(tcp_conn, &tcp_conn->key, false);
+        if (tcp_conn->deferred & TCP_DEFER_ACK)
+            tcp_send_ack(tcp_conn);
+        tcp_conn->deferred = 0;
+    }
+    tcp_defer_queue_len = 0;
+}
+
+/**
+ * @brief 重传最早的未确认报文段，窗口关闭且无数据在途时发送一个字节的零窗口探测
+ *
+ * @param tcp_conn  TCP 连接
+ * @param key       连接的四元组
+ * @return uint32_t 重传报文段占用的序列空间
+ */
+static uint32_t tcp_retransmit(tcp_conn_t *tcp_conn, tcp_key_t *key) {
+    if (tcp_conn->snd_ctl & TCP_FLG_SYN) {
+        tcp_xmit(tcp_conn, key, tcp_conn->snd_una, 0, 0, tcp_syn_flags(tcp_conn));
+        return 1;
+    }
+    size_t in_flight = tcp_conn->snd_max - tcp_conn->snd_una;
+    if (in_flight == 0) {
+        if (tcp_conn->snd_len) {
+            tcp_xmit(tcp_conn, key, tcp_conn->seq, 0, 1, TCP_FLG_ACK);
+            tcp_conn->seq += 1;
+        }
+        return 0;
+    }
+    size_t len = in_flight < tcp_conn->snd_len ? in_flight : tcp_conn->snd_len;
+    size_t mss = tcp_send_mss(tcp_conn, key->remote_ip);
+    uint8_t flags = TCP_FLG_ACK;
+    if (len > mss)
+        len = mss;
+    else if (in_flight > tcp_conn->snd_len)  // 在途的 FIN 随最后一段重传
+        flags |= TCP_FLG_FIN;
+    tcp_xmit(tcp_conn, key, tcp_conn->snd_una, 0, len, flags);
+    return bytes_in_flight(len, flags);
+}
+
+/**
+ * @brief 快速恢复中按 scoreboard 重传下一个尚未重传的空洞，每次一个报文段
+ *
+ * @param tcp_conn  TCP 连接
+ * @param key       连接的四元组
+ * @return int      是否发送了重传，最后一个 SACK 块之后的数据不视为丢失（RFC 6675）
+ */
+static int tcp_sack_retransmit(tcp_conn_t *tcp_conn, tcp_key_t *key) {
+    uint32_t seq = TCP_SEQ_LT(tcp_conn->rexmit_next, tcp_conn->snd_una) ? tcp_conn->snd_una : tcp_conn->rexmit_next;
+    for (size_t i = 0; i < tcp_conn->sacked_num; i++) {
+        tcp_sack_block_t *sb = &tcp_conn->sacked[i];
+        if (TCP_SEQ_LT(seq, sb->start)) {
+            size_t offset = seq - tcp_conn->snd_una;
+            if (offset >= tcp_conn->snd_len)
+                return 0;
+            size_t len = sb->start - seq;
+            if (len > tcp_conn->smss)
+                len = tcp_conn->smss;
+            if (len > tcp_conn->snd_len - offset)
+                len = tcp_conn->snd_len - offset;
+            tcp_xmit(tcp_conn, key, seq, offset, len, TCP_FLG_ACK);
+            tcp_conn->rexmit_next = seq + len;
+            return 1;
+        }
+        if (TCP_SEQ_LT(seq, sb->end))
+            seq = sb->end;
+    }
+    return 0;
+}
+
+/**
+ * @brief 初始化连接的拥塞控制状态，初始窗口取 RFC 6928 的建议值
+ *
+ * @param tcp_conn  TCP 连接
+ * @param mss       发送 MSS
+ */
+static void tcp_cc_init(tcp_conn_t *tcp_conn, size_t mss) {
+    tcp_conn->cc = tcp_cc_default;
+    tcp_conn->smss = mss;
+    uint32_t iw = 2 * mss > 14600 ? 2 * mss : 14600;
+    tcp_conn->cwnd = 10 * mss < iw ? 10 * mss : iw;
+    tcp_conn->ssthresh = UINT32_MAX;
+    tcp_conn->cc->init(tcp_conn);
+}
+
+/**
+ * @brief 处理对端的确认：释放已确认的数据，测量 RTT，更新对端窗口和拥塞窗口，
+ *        收到三个重复 ACK 时快速重传并进入快速恢复（RFC 5681、RFC 6582），
+ *        对端支持 SACK 时每个 ACK 重传一个空洞，一个 RTT 内可以恢复多个丢失的报文段
+ *
+ * @param tcp_conn  TCP 连接
+ * @param key       连接的四元组
+ * @param ack       报文段中的确认号
+ * @param win       报文段中的窗口大小
+ * @param data_len  报文段携带的数据长度
+ * @param flags     报文段的标志位
+ * @param opts      报文段的选项，SACK 块更新 scoreboard，TSecr 用于测量 RTT
+ */
+static void tcp_ack_in(tcp_conn_t *tcp_conn, tcp_key_t *key, uint32_t ack, uint32_t win, size_t data_len, uint8_t flags, tcp_opts_t *opts) {
+    if (TCP_SEQ_LT(ack, tcp_conn->snd_una) || TCP_SEQ_GT(ack, tcp_conn->snd_max))  // 过时的或确认了未发送数据的 ACK
+        return;
+    for (size_t i = 0; tcp_conn->sack_ok && i < opts->sack_num; i++) {
+        tcp_sack_block_t *sb = &opts->sack[i];
+        if (TCP_SEQ_LT(ack, sb->start) && TCP_SEQ_LT(sb->start, sb->end) && TCP_SEQ_LEQ(sb->end, tcp_conn->snd_max))
+            tcp_sack_update(tcp_conn, sb->start, sb->end);
+    }
+    uint32_t old_wnd = tcp_conn->snd_wnd;
+    tcp_conn->snd_wnd = win;
+    if (win == 0)  // 对端仍在通告零窗口，说明连接存活
+        tcp_conn->retries = 0;
+    uint32_t acked = ack - tcp_conn->snd_una;
+    if (acked == 0) {
+        // 重复 ACK：有数据在途，不携带数据和 SYN/FIN，且窗口未变
+        if (tcp_conn->snd_max == tcp_conn->snd_una || data_len || (flags & (TCP_FLG_SYN | TCP_FLG_FIN)) || win != old_wnd) {
+            tcp_conn->dupacks = 0;
+            return;
+        }
+        if (++tcp_conn->dupacks == TCP_DUPACK_THRESHOLD && !tcp_conn->in_recovery) {
+            tcp_conn->ssthresh = tcp_conn->cc->ssthresh(tcp_conn);
+            tcp_conn->recover = tcp_conn->snd_max;
+            tcp_conn->in_recovery = 1;
+            tcp_conn->rexmit_next = tcp_conn->snd_una;
+            if (!tcp_sack_retransmit(tcp_conn, key))
+                tcp_retransmit(tcp_conn, key);
+            tcp_conn->cwnd = tcp_conn->ssthresh + TCP_DUPACK_THRESHOLD * tcp_conn->smss;
+        } else if (tcp_conn->dupacks > TCP_DUPACK_THRESHOLD && tcp_conn->in_recovery) {
+            // 每个重复 ACK 表示一个报文段离开网络，优先用来重传空洞
+            if (!tcp_sack_retransmit(tcp_conn, key))
+                tcp_conn->cwnd += tcp_conn->smss;
+        }
+        return;
+    }
+
+    uint64_t now = time_now_ms();
+    if (tcp_conn->ts_ok && opts->ts && opts->tsecr) {  // 时间戳测量不受重传影响（RFC 7323）
+        tcp_rtt_update(tcp_conn, (uint32_t)now - opts->tsecr);
+        tcp_conn->rtt_start = 0;
+    } else if (tcp_conn->rtt_start && TCP_SEQ_GEQ(ack, tcp_conn->rtt_seq)) {
+        tcp_rtt_update(tcp_conn, now - tcp_conn->rtt_start);
+        tcp_conn->rtt_start = 0;
+    }
+    if (tcp_conn->snd_ctl & TCP_FLG_SYN) {
+        tcp_conn->snd_ctl &= ~TCP_FLG_SYN;
+        acked--;
+    }
+    size_t data = acked < tcp_conn->snd_len ? acked : tcp_conn->snd_len;
+    tcp_sndbuf_consume(tcp_conn, data);
+    if (data)
+        tcp_notify(tcp_conn, TCP_EVENT_WRITE);
+    if (acked > data)
+        tcp_conn->snd_ctl &= ~TCP_FLG_FIN;
+    tcp_conn->snd_una = ack;
+    tcp_sack_trim(tcp_conn);
+    if (TCP_SEQ_LT(tcp_conn->seq, ack))  // 超时回退后，对端确认了回退前发送的数据
+        tcp_conn->seq = ack;
+    tcp_conn->retries = 0;
+    tcp_conn->dupacks = 0;
+    // 仍有数据在途则重启定时器，否则停止
+    tcp_conn->rto_expire = tcp_conn->snd_una == tcp_conn->snd_max ? 0 : now + tcp_conn->rto;
+
+    if (tcp_conn->in_recovery) {
+        if (TCP_SEQ_GEQ(ack, tcp_conn->recover)) {  // 完全确认，退出快速恢复
+            uint32_t flight = tcp_conn->snd_max - tcp_conn->snd_una;
+            flight = (flight > tcp_conn->smss ? flight : tcp_conn->smss) + tcp_conn->smss;
+            tcp_conn->cwnd = tcp_conn->ssthresh < flight ? tcp_conn->ssthresh : flight;
+            tcp_conn->in_recovery = 0;
+        } else {  // 部分确认，重传下一个丢失的报文段并收缩窗口，有 SACK 信息时空洞可能都已重传过
+            if (tcp_conn->sacked_num)
+                tcp_sack_retransmit(tcp_conn, key);
+            else
+                tcp_retransmit(tcp_conn, key);
+            tcp_conn->cwnd = (tcp_conn->cwnd > acked ? tcp_conn->cwnd - acked : 0) + tcp_conn->smss;
+        }
+    } else if (tcp_conn->cwnd < tcp_conn->ssthresh)  // 慢启动
+        tcp_conn->cwnd += acked < tcp_conn->smss ? acked : tcp_conn->smss;
+    else
+        tcp_conn->cc->cong_avoid(tcp_conn, acked);
+}
+
+/**
+ * @brief 重传定时器到期：SYN 和零窗口探测直接重发，数据超时则进入慢启动并从 snd_una 开始重新发送
+ *
+ * @param tcp_conn  TCP 连接
+ * @param key       连接的四元组
+ */
+static void tcp_timeout(tcp_conn_t *tcp_conn, tcp_key_t *key) {
+    if ((tcp_conn->snd_ctl & TCP_FLG_SYN) || tcp_conn->snd_max == tcp_conn->snd_una) {
+        tcp_retransmit(tcp_conn, key);
+        return;
+    }
+    tcp_conn->ssthresh = tcp_conn->cc->ssthresh(tcp_conn);
+    tcp_conn->cwnd = tcp_conn->smss;
+    tcp_conn->in_recovery = 0;
+    tcp_conn->dupacks = 0;
+    tcp_conn->sacked_num = 0;  // 超时后不再信任 SACK 信息（RFC 2018 第 8 节）
+    tcp_conn->seq = tcp_conn->snd_una + tcp_retransmit(tcp_conn, key);
+}
+
+/**
+ * @brief 进入 TIME_WAIT：释放完整的连接，只在 TIME_WAIT 表中保留重新确认对端 FIN 所需的信息
+ *
+ * @param tcp_conn  TCP 连接，调用后不再有效
+ */
+static void tcp_timewait_enter(tcp_conn_t *tcp_conn) {
+    tcp_timewait_t tw = {
+        .seq = tcp_conn->seq,
+        .ack = tcp_conn->ack,
+        .ts_recent = tcp_conn->ts_recent,
+        .ts_ok = tcp_conn->ts_ok,
+    };
+    tcp_key_t key = tcp_conn->key;
+    tcp_free_connection(tcp_conn);
+    tcp_timewait_t *old = tcp_timewait_lookup(&key);
+    if (old)
+        tcp_timewait_remove(old);
+    else if (tcp_timewait_free == NULL)  // 表已满时提前结束最早进入 TIME_WAIT 的四元组
+        tcp_timewait_remove(tcp_timewait_head);
+    tcp_timewait_t *slot = tcp_timewait_free;
+    tcp_timewait_free = slot->hash_next;
+    *slot = tw;
+    slot->key = key;
+    slot->expire = time_now_ms() + TCP_TIME_WAIT_SEC * 1000;
+    tcp_timewait_t **bucket = &tcp_timewait_table[tcp_key_hash(&key, TCP_TIMEWAIT_HASH_SIZE)];
+    slot->hash_next = *bucket;
+    *bucket = slot;
+    tcp_timewait_append(slot);
+    tcp_timewait_num++;
+}
+
+/**
+ * @brief 处理发往 TIME_WAIT 状态四元组的报文段
+ *
+ * @param key       连接的四元组
+ * @param flags     报文段的标志位
+ * @param seq       报文段的序列号
+ * @return int      报文段已处理为1；为0时四元组已被复用，报文段按新连接处理
+ */
+static int tcp_timewait_in(tcp_key_t *key, uint8_t flags, uint32_t seq) {
+    tcp_timewait_t *tw = tcp_timewait_lookup(key);
+    if (tw == NULL)
+        return 0;
+    if (TCP_FLG_ISSET(flags, TCP_FLG_RST)) {
+        tcp_timewait_remove(tw);
+        return 1;
+    }
+    // 序列号大于旧连接的 SYN 不会与旧连接的报文段混淆，提前结束 TIME_WAIT 以复用四元组（RFC 1122 4.2.2.13）
+    if (TCP_FLG_ISSET(flags, TCP_FLG_SYN) && !TCP_FLG_ISSET(flags, TCP_FLG_ACK) && TCP_SEQ_GT(seq, tw->ack)) {
+        tcp_timewait_remove(tw);
+        return 0;
+    }
+    // 对端重传 FIN 说明最后的 ACK 丢失，再次确认并重新开始 2MSL 计时
+    if (TCP_FLG_ISSET(flags, TCP_FLG_FIN)) {
+        tcp_conn_t tcp_conn;
+        tcp_rst(&tcp_conn);
+        tcp_conn.key = *key;
+        tcp_conn.seq = tw->seq;
+        tcp_conn.ack = tw->ack;
+        tcp_conn.ts_recent = tw->ts_recent;
+        tcp_conn.ts_ok = tw->ts_ok;
+        tcp_send_ack(&tcp_conn);
+        tw->expire = time_now_ms() + TCP_TIME_WAIT_SEC * 1000;
+        tcp_timewait_unlink(tw);
+        tcp_timewait_append(tw);
+    }
+    return 1;
+}
+
+/**
+ * @brief 按序收到对端的 FIN 后进行状态转移
+ *
+ * @param tcp_conn  TCP 连接
+ * @param listener  端口上注册的处理程序，可能为NULL
+ */
+static void tcp_fin_in(tcp_conn_t *tcp_conn, tcp_listener_t *listener) {
+    switch (tcp_conn->state) {
+        case TCP_STATE_ESTABLISHED:
+            tcp_conn->state = TCP_STATE_CLOSE_WAIT;
+            // 直接交付数据的处理程序无法得知对端已关闭，由协议栈代为关闭；使用接收缓冲区的应用读完数据后调用 tcp_shutdown()
+            if (listener == NULL || !listener->buffered)
+                tcp_shutdown(tcp_conn);
+            break;
+        case TCP_STATE_FIN_WAIT1:  // 同时关闭，等待本端 FIN 的确认
+            tcp_conn->state = TCP_STATE_CLOSING;
+            break;
+        case TCP_STATE_FIN_WAIT2:  // 回复 ACK 后进入 TIME_WAIT
+            tcp_conn->state = TCP_STATE_TIME_WAIT;
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief 用半连接的信息初始化一个处于 SYN_RECEIVED 的连接，SYN 已发送、尚未被确认
+ *
+ * @param tcp_conn  要初始化的连接
+ * @param key       连接的四元组
+ * @param req       半连接
+ */
+static void tcp_synrecv_init_conn(tcp_conn_t *tcp_conn, tcp_key_t *key, tcp_synrecv_t *req) {
+    tcp_rst(tcp_conn);
+    tcp_conn->key = *key;
+    tcp_conn->state = TCP_STATE_SYN_RECEIVED;
+    tcp_conn->seq = req->iss;
+    tcp_conn->snd_una = req->iss;
+    tcp_conn->snd_max = req->iss;
+    tcp_conn->snd_sml = req->iss;
+    tcp_conn->snd_ctl = TCP_FLG_SYN;
+    tcp_conn->snd_wnd = req->snd_wnd;
+    tcp_conn->rto = TCP_RETRANSMISSON_TIMEOUT * 1000;
+    tcp_conn->rcv_size = TCP_RECV_BUFFER_SIZE;
+    tcp_conn->ack = req->irs + 1;
+    tcp_conn->rcv_adv = tcp_conn->ack;
+
+    // 对端提供的选项在 SYN-ACK 中同样提供，即协商成功
+    tcp_conn->mss = req->mss;
+    if (req->snd_wscale != TCP_WSCALE_NONE) {
+        tcp_conn->snd_wscale = req->snd_wscale;
+        tcp_conn->rcv_wscale = TCP_WSCALE;
+    }
+    tcp_conn->sack_ok = req->sack_ok;
+    tcp_conn->ts_ok = req->ts_ok;
+    tcp_conn->ts_recent = req->ts_recent;
+    tcp_conn->rcv_mss = net_if_select(key->host_ip, key->remote_ip)->mtu - sizeof(ip_hdr_t) - sizeof(tcp_hdr_t) - (tcp_conn->ts_ok ? TCP_OPT_TS_LEN : 0);
+}
+
+/**
+ * @brief 为半连接发送（或重传）SYN-ACK
+ *
+ * @param key       连接的四元组
+ * @param req       半连接
+ */
+static void tcp_synrecv_send(tcp_key_t *key, tcp_synrecv_t *req) {
+    tcp_conn_t tcp_conn;
+    tcp_synrecv_init_conn(&tcp_conn, key, req);
+    buf_init(&txbuf, 0);
+    tcp_out_seq(&tcp_conn, &txbuf, req->iss, key->host_ip, key->host_port, key->remote_ip, key->remote_port, TCP_FLG_SYN | TCP_FLG_ACK);
+}
+
+/**
+ * @brief 移除一个半连接，归还半连接池
+ *
+ * @param req       半连接
+ */
+static void tcp_synrecv_drop(tcp_synrecv_t *req) {
+    tcp_listener_t *listener = map_get(&tcp_handler_table, &req->key.host_port);
+    if (listener && listener->syn_queued)
+        listener->syn_queued--;
+    tcp_synrecv_t **link = &tcp_synrecv_table[tcp_key_hash(&req->key, TCP_CONN_HASH_SIZE)];
+    while (*link != req)
+        link = &(*link)->hash_next;
+    *link = req->hash_next;
+    tcp_synrecv_unlink(req);
+    req->hash_next = tcp_synrecv_free;
+    tcp_synrecv_free = req;
+    tcp_synrecv_num--;
+}
+
+/**
+ * @brief 握手完成，为连接分配完整的状态
+ *
+ * @param key       连接的四元组
+ * @param req       半连接
+ * @param listener  端口上注册的处理程序，提供空闲超时和保活的设置
+ * @return tcp_conn_t*  新连接，连接表已满时为NULL
+ */
+static tcp_conn_t *tcp_synrecv_accept(tcp_key_t *key, tcp_synrecv_t *req, tcp_listener_t *listener) {
+    tcp_conn_t new_conn;
+    tcp_synrecv_init_conn(&new_conn, key, req);
+    new_conn.seq = req->iss + 1;
+    new_conn.snd_max = req->iss + 1;
+    new_conn.rto_expire = time_now_ms() + new_conn.rto;
+    // SYN-ACK 已确认了对端的 SYN，并通告了不扩大的窗口
+    uint32_t wnd = tcp_rcv_window(&new_conn);
+    new_conn.rcv_adv = new_conn.ack + (wnd < TCP_MAX_WINDOW_SIZE ? wnd : TCP_MAX_WINDOW_SIZE);
+    new_conn.rcv_wup = new_conn.ack;
+    if (req->retries == 0) {  // 未重传过的 SYN-ACK 可以用于测量 RTT（Karn 算法）
+        new_conn.rtt_seq = req->iss + 1;
+        new_conn.rtt_start = req->sent;
+    }
+    tcp_cc_init(&new_conn, tcp_send_mss(&new_conn, key->remote_ip));
+    new_conn.listener = listener;
+    new_conn.idle_timeout = listener->idle_timeout;
+    new_conn.keepalive = listener->keepalive;
+    return tcp_conn_insert(&new_conn);
+}
+
+/**
+ * @brief SYN cookie 中的计数器，每 TCP_COOKIE_PERIOD_SEC 秒递增
+ *
+ */
+static inline uint32_t tcp_cookie_count() {
+#ifdef TEST
+    return 0;  // 测试数据按固定的计数器和密钥录制，对端确认的 cookie 依赖于它们
+#else
+    return time_now_ms() / (TCP_COOKIE_PERIOD_SEC * 1000);
+#endif
+}
+
+/**
+ * @brief 计算 SYN cookie 中的 24 位校验值，与四元组、计数器、密钥和对端初始序列号绑定
+ *
+ */
+static uint32_t tcp_cookie_hash(tcp_key_t *key, uint32_t count, uint32_t irs) {
+    uint32_t h = 2166136261u ^ tcp_cookie_secret;  // FNV-1a
+    const uint8_t *p = (const uint8_t *)key;
+    for (size_t i = 0; i < sizeof(tcp_key_t); i++)
+        h = (h ^ p[i]) * 16777619u;
+    for (size_t i = 0; i < sizeof(count); i++)
+        h = (h ^ (uint8_t)(count >> (8 * i))) * 16777619u;
+    return (h + irs) & 0xffffff;
+}
+
+/**
+ * @brief 生成 SYN cookie 作为本端的初始序列号：高 5 位为计数器，其后 3 位为 MSS 编号，低 24 位为校验值
+ *
+ * @param key       连接的四元组
+ * @param irs       对端的初始序列号
+ * @param mss       对端通告的 MSS，编码为不超过它的最大表项
+ * @return uint32_t SYN cookie
+ */
+static uint32_t tcp_cookie_make(tcp_key_t *key, uint32_t irs, uint16_t mss) {
+    uint32_t count = tcp_cookie_count();
+    uint32_t idx = 0;
+    while (idx + 1 < sizeof(tcp_cookie_mss) / sizeof(tcp_cookie_mss[0]) && tcp_cookie_mss[idx + 1] <= mss)
+        idx++;
+    return (count & 0x1f) << 27 | idx << 24 | tcp_cookie_hash(key, count, irs);
+}
+
+/**
+ * @brief 校验握手最后一个 ACK 确认的 SYN cookie
  *
- * @return tcp_conn_t* 指向已存在或新创建的 TCP 连接的指针；若未找到且无需创建，则返回 NULL
+ * @param key       连接的四元组
+ * @param irs       对端的初始序列号
+ * @param cookie    被确认的本端初始序列号
+ * @return uint16_t cookie 中编码的 MSS，cookie 无效或过期时为0
  */
-static inline tcp_conn_t *tcp_get_connection(uint8_t remote_ip[NET_IP_LEN], uint16_t remote_port, uint16_t host_port, uint8_t create_if_missing) {
-    tcp_key_t key = generate_tcp_key(remote_ip, remote_port, host_port);
-    tcp_conn_t *tcp_conn = map_get(&tcp_conn_table, &key);
-    if (!tcp_conn && create_if_missing) {
-        tcp_conn_t new_conn;
-        tcp_rst(&new_conn);
-        map_set(&tcp_conn_table, &key, &new_conn);
-        tcp_conn = map_get(&tcp_conn_table, &key);
+static uint16_t tcp_cookie_check(tcp_key_t *key, uint32_t irs, uint32_t cookie) {
+    uint32_t now = tcp_cookie_count();
+    for (uint32_t age = 0; age < TCP_COOKIE_MAX_AGE; age++) {
+        uint32_t count = now - age;
+        if (cookie >> 27 != (count & 0x1f))
+            continue;
+        if ((cookie & 0xffffff) != tcp_cookie_hash(key, count, irs))
+            return 0;
+        return tcp_cookie_mss[(cookie >> 24) & 0x7];
     }
-    return tcp_conn;
+    return 0;
 }
 
 /**
- * @brief 关闭一个 TCP 连接
+ * @brief 处理不属于任何连接的报文段：SYN 加入半连接队列并回复 SYN-ACK，队列已满时改用 SYN cookie，
+ *        不保留任何状态；确认了 SYN-ACK 的 ACK 完成握手，此时才分配完整的连接
  *
- * @param remote_ip
- * @param remote_port
- * @param host_port
+ * @param key       连接的四元组
+ * @param flags     报文段的标志位
+ * @param seq       报文段的序列号
+ * @param ack       报文段的确认号
+ * @param win       报文段中的窗口大小
+ * @param opts      报文段的选项
+ * @return tcp_conn_t*  握手完成时为新连接，否则为NULL
  */
-static inline void tcp_close_connection(uint8_t remote_ip[NET_IP_LEN], uint16_t remote_port, uint16_t host_port) {
-    tcp_key_t key = generate_tcp_key(remote_ip, remote_port, host_port);
-    map_delete(&tcp_conn_table, &key);
-}
+static tcp_conn_t *tcp_listen_in(tcp_key_t *key, uint8_t flags, uint32_t seq, uint32_t ack, uint16_t win, tcp_opts_t *opts) {
+    tcp_listener_t *listener = map_get(&tcp_handler_table, &key->host_port);
+    if (listener == NULL || listener->active || listener->closed)  // 主动打开占用的端口和已停止监听的端口不接受连接
+        return NULL;
+    tcp_synrecv_t *req = tcp_synrecv_num ? tcp_synrecv_lookup(key) : NULL;
+    if (TCP_FLG_ISSET(flags, TCP_FLG_RST)) {
+        if (req)
+            tcp_synrecv_drop(req);
+        return NULL;
+    }
 
-/* =============================== TOOLS =============================== */
+    if (TCP_FLG_ISSET(flags, TCP_FLG_SYN)) {
+        if (TCP_FLG_ISSET(flags, TCP_FLG_ACK))
+            return NULL;
+        if (req) {  // 对端重传了 SYN，说明 SYN-ACK 丢失
+            if (seq == req->irs)
+                tcp_synrecv_send(key, req);
+            return NULL;
+        }
+        tcp_synrecv_t new_req = {
+            .key = *key,
+            .iss = tcp_generate_initial_seq(),
+            .irs = seq,
+            .snd_wnd = win,
+            .ts_recent = opts->tsval,
+            .mss = opts->mss,
+            .snd_wscale = opts->wscale,
+            .sack_ok = opts->sack_perm,
+            .ts_ok = opts->ts,
+            .sent = time_now_ms(),
+            .expire = time_now_ms() + TCP_RETRANSMISSON_TIMEOUT * 1000,
+        };
+        if (listener->syn_queued < TCP_SYN_BACKLOG && tcp_synrecv_insert(&new_req)) {
+            listener->syn_queued++;
+        } else {
+            // 半连接队列已满：状态编码进初始序列号，窗口扩大、SACK 和时间戳无处保存，不再协商
+            new_req.iss = tcp_cookie_make(key, seq, opts->mss);
+            new_req.snd_wscale = TCP_WSCALE_NONE;
+            new_req.sack_ok = 0;
+            new_req.ts_ok = 0;
+        }
+        tcp_synrecv_send(key, &new_req);
+        return NULL;
+    }
 
-/* =============================== COMMON API =============================== */
+    if (!TCP_FLG_ISSET(flags, TCP_FLG_ACK))
+        return NULL;
+    if (req) {
+        if (ack != req->iss + 1)
+            return NULL;
+        tcp_synrecv_t done = *req;
+        tcp_synrecv_drop(req);
+        return tcp_synrecv_accept(key, &done, listener);
+    }
+    uint16_t mss = tcp_cookie_check(key, seq - 1, ack - 1);
+    if (mss == 0)  // 不属于任何连接的 ACK
+        return NULL;
+    tcp_synrecv_t cookie_req = {
+        .iss = ack - 1,
+        .irs = seq - 1,
+        .snd_wnd = win,
+        .mss = mss,
+        .snd_wscale = TCP_WSCALE_NONE,
+        .retries = 1,  // 不知道 SYN-ACK 的发送时间，不测量 RTT
+    };
+    return tcp_synrecv_accept(key, &cookie_req, listener);
+}
 
 /**
- * @brief 填写 TCP 报文头并发送
+ * @brief 延迟确认：未确认的数据超过一个满长度报文段时，在本轮收包结束后合并确认，否则等待定时器或顺带确认
  *
- * @param tcp_conn  指向当前 TCP 连接的指针，用于获取和更新序列号、确认号、窗口大小等状态信息
- * @param buf       数据缓冲区，payload 为要发送的数据
- * @param src_port  源端口号
- * @param dst_ip    目标IP地址
- * @param dst_port  目标端口号
- * @param flags     TCP 标志位
+ * @param tcp_conn  TCP 连接
  */
-void tcp_out(tcp_conn_t *tcp_conn, buf_t *buf, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port, uint8_t flags) {
-    /* =============================== TODO 1 BEGIN =============================== */
-    /* Step1: 添加 TCP 报头 */
-    buf_add_header(buf, sizeof(tcp_hdr_t));
-    
-    /* Step2: 填充 TCP 首部字段 */
-    tcp_hdr_t *hdr = (tcp_hdr_t *)buf->data;
-    hdr->src_port16 = swap16(src_port);
-    hdr->dst_port16 = swap16(dst_port);
-    hdr->seq = swap32(tcp_conn->seq);
-    hdr->ack = swap32(tcp_conn->ack);
-    hdr->doff = (sizeof(tcp_hdr_t) / 4) << 4;  // 首部长度，高4位表示，以4字节为单位
-    hdr->flags = flags;
-    hdr->win = swap16(TCP_MAX_WINDOW_SIZE);    // 最大窗口大小
-    hdr->uptr = 0;                             // urgent pointer 置零
-    
-    /* Step3: 计算并填充校验和 */
-    hdr->checksum16 = 0;
-    hdr->checksum16 = transport_checksum(NET_PROTOCOL_TCP, buf, net_if_ip, dst_ip);
-    
-    /* Step4: 发送 TCP 数据报 */
-    ip_out(buf, dst_ip, NET_PROTOCOL_TCP);
-    /* =============================== TODO 1 END =============================== */
+static void tcp_delack(tcp_conn_t *tcp_conn) {
+    if (tcp_conn->ack - tcp_conn->rcv_wup > tcp_conn->rcv_mss)
+        tcp_defer(tcp_conn, TCP_DEFER_ACK);
+    else if (tcp_conn->delack_expire == 0)
+        tcp_conn->delack_expire = time_now_ms() + TCP_DELACK_MS;
+}
+
+/**
+ * @brief 首部预测（Van Jacobson）：已建立的连接上按序到达、窗口不变的纯 ACK 或纯数据报文段
+ *        不经过选项解析、状态机和处理程序查找，其余报文段返回0交给完整的处理流程
+ *
+ * @param tcp_conn  最近收到报文段的连接
+ * @param hdr       TCP 首部
+ * @param hdr_len   首部长度
+ * @param data      报文段携带的数据
+ * @param data_len  数据长度
+ * @return int      已处理为1
+ */
+static int tcp_fast_path(tcp_conn_t *tcp_conn, tcp_hdr_t *hdr, size_t hdr_len, uint8_t *data, size_t data_len) {
+    uint32_t seq = swap32(hdr->seq);
+    if (tcp_conn->state != TCP_STATE_ESTABLISHED || (hdr->flags & (TCP_FLG_URG | TCP_FLG_ACK | TCP_FLG_RST | TCP_FLG_SYN | TCP_FLG_FIN)) != TCP_FLG_ACK ||
+        seq != tcp_conn->ack || ((uint32_t)swap16(hdr->win) << tcp_conn->snd_wscale) != tcp_conn->snd_wnd ||
+        tcp_conn->ooo_head || tcp_conn->snd_ctl || tcp_conn->in_recovery || tcp_conn->dupacks)
+        return 0;
+
+    // 选项只能是协商过的时间戳，且按 RFC 7323 附录 A 建议的方式对齐
+    tcp_opts_t opts;
+    opts.ts = 0;
+    opts.sack_num = 0;
+    if (tcp_conn->ts_ok) {
+        uint8_t *opt = (uint8_t *)(hdr + 1);
+        if (hdr_len != TCP_HEADER_LEN + TCP_OPT_TS_LEN || opt[0] != TCP_OPT_NOP || opt[1] != TCP_OPT_NOP || opt[2] != TCP_OPT_TS || opt[3] != 10)
+            return 0;
+        memcpy(&opts.tsval, opt + 4, 4);
+        memcpy(&opts.tsecr, opt + 8, 4);
+        opts.tsval = swap32(opts.tsval);
+        opts.tsecr = swap32(opts.tsecr);
+        if (TCP_SEQ_LT(opts.tsval, tcp_conn->ts_recent))  // 由完整流程执行 PAWS
+            return 0;
+        opts.ts = 1;
+    } else if (hdr_len != TCP_HEADER_LEN) {
+        return 0;
+    }
+
+    uint32_t ack = swap32(hdr->ack);
+    tcp_listener_t *listener = tcp_conn->listener;
+    if (data_len == 0) {  // 纯 ACK：确认了新数据
+        if (!TCP_SEQ_GT(ack, tcp_conn->snd_una) || TCP_SEQ_GT(ack, tcp_conn->snd_max))
+            return 0;
+    } else if (ack != tcp_conn->snd_una || data_len > tcp_conn->rcv_size - tcp_conn->rcv_len || listener == NULL) {
+        return 0;  // 纯数据：没有确认新数据，接收缓冲区放得下
+    }
+
+    if (opts.ts)
+        tcp_conn->ts_recent = opts.tsval;
+    tcp_conn->last_recv = time_now_ms();
+    tcp_conn->keepalive_probes = 0;
+    tcp_conn->not_send_empty_ack = 0;
+    if (data_len == 0) {
+        tcp_ack_in(tcp_conn, &tcp_conn->key, ack, tcp_conn->snd_wnd, 0, TCP_FLG_ACK, &opts);
+        tcp_output(tcp_conn, &tcp_conn->key, false);
+        return 1;
+    }
+
+    tcp_conn->ack += data_len;
+    tcp_deliver(tcp_conn, listener, data, data_len);
+    tcp_rcvbuf_autotune(tcp_conn);
+    if (listener->buffered)
+        listener->handler(tcp_conn, NULL, tcp_conn->rcv_len, tcp_conn->key.remote_ip, tcp_conn->key.remote_port);
+    if (!tcp_conn->not_send_empty_ack)  // 处理程序发送的数据已顺带确认
+        tcp_delack(tcp_conn);
+    tcp_conn->not_send_empty_ack = 0;
+    return 1;
 }
 
 /**
@@ -154,173 +1724,488 @@ void tcp_in(buf_t *buf, uint8_t *src_ip) {
 
     tcp_hdr_t *hdr = (tcp_hdr_t *)buf->data;
 
-    // 校验checksum
+    // 校验checksum，GRO合并的包已逐段校验过
     uint16_t checksum = hdr->checksum16;
     hdr->checksum16 = 0;
-    if (transport_checksum(NET_PROTOCOL_TCP, buf, src_ip, net_if_ip) != checksum)
+    if (!buf->csum_ok && transport_checksum(NET_PROTOCOL_TCP, buf, src_ip, buf->netif->ip) != checksum)
         return;
 
     uint8_t *remote_ip = src_ip;
     uint16_t remote_port = swap16(hdr->src_port16);
     uint16_t host_port = swap16(hdr->dst_port16);
-    tcp_conn_t *tcp_conn = tcp_get_connection(remote_ip, remote_port, host_port, true);
-
+    tcp_key_t key = generate_tcp_key(buf->netif->ip, remote_ip, remote_port, host_port);
     uint8_t recv_flags = hdr->flags;
+    uint32_t remote_seq = swap32(hdr->seq);
+    uint32_t remote_ack = swap32(hdr->ack);
+    uint16_t remote_win = swap16(hdr->win);
+    uint32_t tcp_hdr_sz = (hdr->doff >> 4) * 4;
+    if (tcp_hdr_sz < sizeof(tcp_hdr_t) || tcp_hdr_sz > buf->len)
+        return;
+    uint8_t *data = buf->data + tcp_hdr_sz;
+    size_t data_len = buf->len - tcp_hdr_sz;
+
+    // 已建立连接的后续报文段大多可以走首部预测的快速路径
+    tcp_conn_t *tcp_conn = tcp_conn_lookup(&key);
+    if (tcp_conn && tcp_fast_path(tcp_conn, hdr, tcp_hdr_sz, data, data_len))
+        return;
+
+    tcp_opts_t opts;
+    tcp_parse_options(hdr, tcp_hdr_sz, &opts);
+
+    if (tcp_conn == NULL) {
+        // 处于 TIME_WAIT 的四元组不在连接表中
+        if (tcp_timewait_num && tcp_timewait_in(&key, recv_flags, remote_seq))
+            return;
+
+        // 连接只在握手完成后分配，此前的报文段由半连接队列或 SYN cookie 处理，不会占用连接池
+        tcp_conn = tcp_listen_in(&key, recv_flags, remote_seq, remote_ack, remote_win, &opts);
+        if (tcp_conn == NULL)
+            return;
+    }
+
     // 收到RST，关闭 TCP 连接
     if (TCP_FLG_ISSET(recv_flags, TCP_FLG_RST)) {
-        tcp_close_connection(remote_ip, remote_port, host_port);
+        tcp_free_connection(tcp_conn);
         return;
     }
+    tcp_conn->not_send_empty_ack = 0;
+    tcp_conn->last_recv = time_now_ms();
+    tcp_conn->keepalive_probes = 0;
 
-    uint32_t remote_seq = swap32(hdr->seq);
-    uint32_t tcp_hdr_sz = (hdr->doff >> 4) * 4;
+    // SYN 之外的报文段中的窗口按协商的因子扩大
+    uint32_t remote_wnd = remote_win;
+    if (!TCP_FLG_ISSET(recv_flags, TCP_FLG_SYN))
+        remote_wnd <<= tcp_conn->snd_wscale;
+
+    // 时间戳早于最近记录的报文段是回绕前的旧报文段，丢弃并回复 ACK（PAWS，RFC 7323）
+    if (tcp_conn->ts_ok && opts.ts && tcp_conn->state != TCP_STATE_SYN_SENT) {
+        if (TCP_SEQ_LT(opts.tsval, tcp_conn->ts_recent)) {
+            tcp_send_ack(tcp_conn);
+            return;
+        }
+        if (TCP_SEQ_LEQ(remote_seq, tcp_conn->ack))
+            tcp_conn->ts_recent = opts.tsval;
+    }
+
+    tcp_listener_t *listener = tcp_conn->listener;
 
     /* =============================== TODO 2 BEGIN =============================== */
     /* Step1 ：根据接收包数据更新当前TCP连接内部状态，并填写回复报文的标志部分。 */
 
     uint8_t send_flags = 0;  // 回复报文的标志位字段
+    uint8_t ack_now = 0;     // 是否需要立即回复，而不是延迟确认
+    uint8_t fin = 0;         // 是否按序收到了对端的 FIN
 
      // 根据当前 TCP 连接的状态进行不同的处理    
     switch (tcp_conn->state) {
-        case TCP_STATE_LISTEN:
-            // 仅在收到连接报文时（SYN报文）才做出处理，否则直接返回
-            if (!TCP_FLG_ISSET(recv_flags, TCP_FLG_SYN)) {
+        case TCP_STATE_SYN_SENT:
+            // 仅在收到确认了 SYN 的 SYN-ACK 时才做出处理，不支持同时打开
+            if (!TCP_FLG_ISSET(recv_flags, TCP_FLG_SYN) || !TCP_FLG_ISSET(recv_flags, TCP_FLG_ACK) || remote_ack != tcp_conn->snd_max) {
                 return;
             }
-
-            // 初始化 TCP 连接上下文（tcp_conn结构体）的seq字段
-            tcp_conn->seq = tcp_generate_initial_seq();
-
-            // 填写 TCP 连接上下文（tcp_conn结构体）的ack字段
             tcp_conn->ack = remote_seq + 1;
+            tcp_conn->rcv_adv = tcp_conn->ack;
 
-            // 填写回复标志 send_flags
-            send_flags = TCP_FLG_SYN | TCP_FLG_ACK;
-
-            // 进行状态转移
-            tcp_conn->state = TCP_STATE_SYN_RECEIVED;
+            // SYN 中提供的选项只有对端在 SYN-ACK 中同样提供时才生效
+            tcp_conn->mss = opts.mss;
+            if (opts.wscale != TCP_WSCALE_NONE)
+                tcp_conn->snd_wscale = opts.wscale;
+            else
+                tcp_conn->rcv_wscale = 0;
+            tcp_conn->sack_ok = opts.sack_perm;
+            tcp_conn->ts_ok = opts.ts;
+            tcp_conn->ts_recent = opts.tsval;
+            tcp_conn->rcv_mss = net_if_select(tcp_conn->key.host_ip, remote_ip)->mtu - sizeof(ip_hdr_t) - sizeof(tcp_hdr_t) - (tcp_conn->ts_ok ? TCP_OPT_TS_LEN : 0);
+            tcp_cc_init(tcp_conn, tcp_send_mss(tcp_conn, remote_ip));
+            tcp_ack_in(tcp_conn, &key, remote_ack, remote_wnd, 0, recv_flags, &opts);
 
+            // 进行状态转移，立即确认 SYN-ACK，通知处理程序可以开始发送
+            tcp_conn->state = TCP_STATE_ESTABLISHED;
+            data_len = 0;
+            send_flags |= TCP_FLG_ACK;
+            ack_now = 1;
+            if (listener)
+                listener->handler(tcp_conn, NULL, 0, remote_ip, remote_port);
             break;
 
         case TCP_STATE_SYN_RECEIVED:
-            // 仅在收到确认报文时（ACK报文）才做出处理，否则直接返回
+            // 仅在收到确认了 SYN 的报文时才做出处理，否则直接返回
             if (!TCP_FLG_ISSET(recv_flags, TCP_FLG_ACK)) {
                 return;
             }
+            tcp_ack_in(tcp_conn, &key, remote_ack, remote_wnd, data_len, recv_flags, &opts);
+            if (tcp_conn->snd_ctl & TCP_FLG_SYN) {
+                return;
+            }
 
-            // 进行状态转移
+            // 进行状态转移，ACK 可能携带数据，按已建立连接继续处理
             tcp_conn->state = TCP_STATE_ESTABLISHED;
-
-            break;
+            tcp_notify(tcp_conn, TCP_EVENT_ACCEPT);
+            /* fall through */
 
         case TCP_STATE_ESTABLISHED:
-            // 未收到顺序包，丢弃并发送重复 ACK
+        case TCP_STATE_FIN_WAIT1:
+        case TCP_STATE_FIN_WAIT2:
+        case TCP_STATE_CLOSE_WAIT:
+        case TCP_STATE_CLOSING:
+        case TCP_STATE_LAST_ACK:
+            if (TCP_FLG_ISSET(recv_flags, TCP_FLG_ACK))
+                tcp_ack_in(tcp_conn, &key, remote_ack, remote_wnd, data_len, recv_flags, &opts);
+
+            // 本端的 FIN 被确认后进行状态转移
+            if (!(tcp_conn->snd_ctl & TCP_FLG_FIN)) {
+                if (tcp_conn->state == TCP_STATE_FIN_WAIT1) {
+                    tcp_conn->state = TCP_STATE_FIN_WAIT2;
+                } else if (tcp_conn->state == TCP_STATE_CLOSING) {
+                    tcp_timewait_enter(tcp_conn);
+                    return;
+                } else if (tcp_conn->state == TCP_STATE_LAST_ACK) {
+                    tcp_free_connection(tcp_conn);
+                    return;
+                }
+            }
+
+            // 已收到对端的 FIN，之后的数据无效，重传的 FIN 只需再次确认
+            if (tcp_conn->state == TCP_STATE_CLOSE_WAIT || tcp_conn->state == TCP_STATE_CLOSING || tcp_conn->state == TCP_STATE_LAST_ACK) {
+                if (data_len > 0 || TCP_FLG_ISSET(recv_flags, TCP_FLG_FIN)) {
+                    send_flags |= TCP_FLG_ACK;
+                    ack_now = 1;
+                }
+                data_len = 0;
+                break;
+            }
+
+            // 与已接收数据部分重叠的报文段，裁掉重复的部分
+            if (TCP_SEQ_LT(remote_seq, tcp_conn->ack) && TCP_SEQ_GT(remote_seq + data_len, tcp_conn->ack)) {
+                uint32_t dup = tcp_conn->ack - remote_seq;
+                data += dup;
+                data_len -= dup;
+                remote_seq = tcp_conn->ack;
+            }
+
+            // 未收到顺序包，超前的数据放入乱序队列，并发送重复 ACK 告知期望的序列号
             if (remote_seq != tcp_conn->ack) {
-                buf_init(&txbuf, 0);
-                tcp_out(tcp_conn, &txbuf, host_port, remote_ip, remote_port, TCP_FLG_ACK);
+                if (data_len > 0 || TCP_FLG_ISSET(recv_flags, TCP_FLG_FIN)) {
+                    if (TCP_SEQ_GT(remote_seq, tcp_conn->ack))
+                        tcp_ooo_insert(tcp_conn, remote_seq, data, data_len, TCP_FLG_ISSET(recv_flags, TCP_FLG_FIN));
+                    tcp_send_ack(tcp_conn);
+                }
+                tcp_output(tcp_conn, &key, false);
                 return;
             }
-            // 计算接收到的数据长度，更新 ACK
-            size_t data_len = buf->len - tcp_hdr_sz;
-            tcp_conn->ack = remote_seq + bytes_in_flight(data_len, recv_flags);
+            // 超出接收缓冲区剩余空间的数据（包括零窗口探测）丢弃，回复 ACK 告知当前窗口
+            if (data_len > tcp_conn->rcv_size - tcp_conn->rcv_len) {
+                data_len = tcp_conn->rcv_size - tcp_conn->rcv_len;
+                recv_flags &= ~TCP_FLG_FIN;
+                send_flags |= TCP_FLG_ACK;
+                ack_now = 1;
+            }
+
+            // 填补了空洞的报文段立即确认，让对端尽快结束快速恢复（RFC 5681 4.2）
+            if (tcp_conn->ooo_head)
+                ack_now = 1;
+
+            // 更新 ACK
+            tcp_conn->ack = remote_seq + bytes_in_flight(data_len, recv_flags & TCP_FLG_FIN);
 
             // 如果接收报文携带数据，则填写回复标志 send_flags 发送ACK
             if (data_len > 0) {
                 send_flags |= TCP_FLG_ACK;
             }
 
-            // 如果收到 FIN 报文，则增加 send_flags 相应标志位，并且进行状态转移
+            // 收到 FIN 报文，在交付数据之后进行状态转移
             if (TCP_FLG_ISSET(recv_flags, TCP_FLG_FIN)) {
-                send_flags |= TCP_FLG_ACK | TCP_FLG_FIN;
-                tcp_conn->state = TCP_STATE_LAST_ACK;
+                send_flags |= TCP_FLG_ACK;
+                ack_now = 1;
+                fin = 1;
             }
-
             break;
 
-        case TCP_STATE_LAST_ACK:
-            // 仅在收到确认报文时（ACK报文）才做出处理，否则直接返回
-            if (!TCP_FLG_ISSET(recv_flags, TCP_FLG_ACK)) {
-                return;
-            }
-
-            // 关闭 TCP 连接
-            tcp_close_connection(remote_ip, remote_port, host_port);
+        default:  // LISTEN、CLOSED 不会出现在连接表中，TIME_WAIT 在 TIME_WAIT 表中
             return;
-
-        default:
-            printf("do not support state %d\n", tcp_conn->state);
-            break;
     }
 
-    /* Step2 ：如果接收报文携带数据，则将数据部分交付给上层应用 */
-    if (buf->len > tcp_hdr_sz) {
-        // 查询是否有该目的端口号对应的处理函数
-        tcp_handler_t *handler = (tcp_handler_t *)map_get(&tcp_handler_table, &host_port);
-        if (handler == NULL) {
-            // 没有找到处理函数，发送端口不可达的ICMP差错报文
+    /* Step2 ：如果接收报文携带数据，则将数据部分交付给上层应用，随后交付乱序队列中已连续的数据，最后处理 FIN */
+    if (data_len > 0 || fin) {
+        if (listener == NULL && data_len > 0) {
+            // 没有找到处理程序，发送端口不可达的ICMP差错报文
             buf_add_header(buf, sizeof(ip_hdr_t));
             icmp_unreachable(buf, src_ip, ICMP_CODE_PORT_UNREACH);
             return;
-        } else {
-            // 去掉TCP报头，调用处理函数
-            buf_remove_header(buf, tcp_hdr_sz);
-            (*handler)(tcp_conn, buf->data, buf->len, remote_ip, remote_port);
         }
+        if (data_len > 0) {
+            // 去掉TCP报头，交付数据
+            tcp_deliver(tcp_conn, listener, data, data_len);
+            if (tcp_ooo_deliver(tcp_conn, listener))
+                fin = 1;
+            tcp_rcvbuf_autotune(tcp_conn);
+        }
+        if (fin)
+            tcp_fin_in(tcp_conn, listener);
+        // 写入接收缓冲区的数据一次性通知处理程序读取，对端关闭时 state 为 CLOSE_WAIT
+        if (listener && listener->buffered)
+            listener->handler(tcp_conn, NULL, tcp_conn->rcv_len, remote_ip, remote_port);
     }
 
-    /* Step3 ：调用tcp_out()发送回复报文，更新TCP连接序列号。 */
-    // 如果无需回复，则接收逻辑结束
-    if (send_flags == 0)
-        return;
-    // 如果 send_flags 只标识了 ACK 字段，并且应用程序已通过 tcp_send() 发送顺带 ACK，则无需再进行回复
-    if (bytes_in_flight(0, send_flags) == 0 && tcp_conn->not_send_empty_ack) {
-        assert(TCP_FLG_ISSET(send_flags, TCP_FLG_ACK));
-        tcp_conn->not_send_empty_ack = 0;
-        return;
+    /* Step3 ：调用tcp_output()发送缓冲区中的数据和 FIN，必要时再回复 ACK。 */
+    tcp_output(tcp_conn, &key, false);
+    // 如果无需回复，或者已有报文段顺带了最新的 ACK，则无需再进行回复。
+    // 处理程序在交付乱序队列之前发送的数据只确认到当时的位置
+    if (send_flags && (!tcp_conn->not_send_empty_ack || tcp_conn->rcv_wup != tcp_conn->ack)) {
+        if (ack_now) {
+            // 初始化一个新的缓冲区，发送回复报文
+            buf_init(&txbuf, 0);
+            tcp_out(tcp_conn, &txbuf, host_port, remote_ip, remote_port, send_flags);
+        } else {
+            tcp_delack(tcp_conn);
+        }
     }
+    tcp_conn->not_send_empty_ack = 0;
 
-    // 初始化一个新的缓冲区，发送回复报文
-    buf_init(&txbuf, 0);
-    tcp_out(tcp_conn, &txbuf, host_port, remote_ip, remote_port, send_flags);
-
-    // 更新序列号
-    tcp_conn->seq += bytes_in_flight(0, send_flags);
+    // 对端的 FIN 已确认，释放连接
+    if (tcp_conn->state == TCP_STATE_TIME_WAIT)
+        tcp_timewait_enter(tcp_conn);
 
     /* =============================== TODO 2 END =============================== */
 }
 
 /**
- * @brief 发送一个 TCP 包
+ * @brief 发送 TCP 数据：写入发送缓冲区，并在对端窗口允许的范围内按 MSS 分段发送，未确认的数据由定时器重传，
+ *        不足 MSS 的数据受 Nagle 算法限制
  *
  * @param tcp_conn  指向当前 TCP 连接的指针
  * @param data      要发送的数据
  * @param len       数据长度
- * @param src_port  源端口号
- * @param dst_ip    目的ip地址
- * @param dst_port  目的端口号
+ * @param src_port  源端口号，须与连接的本端端口一致
+ * @param dst_ip    目的ip地址，须与连接的对端地址一致
+ * @param dst_port  目的端口号，须与连接的对端端口一致
+ * @return size_t   写入发送缓冲区的长度，缓冲区达到上限时小于 len
  */
-void tcp_send(tcp_conn_t *tcp_conn, uint8_t *data, uint16_t len, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port) {
-    // 检查payload长度是否合法
-    if (len > TCP_MAX_WINDOW_SIZE) {
-        printf("package is too big [max value = %d, current value = %d], please split it into small pieces in the user functions.\n", TCP_MAX_WINDOW_SIZE, len);
-        return;
-    }
+size_t tcp_send(tcp_conn_t *tcp_conn, uint8_t *data, size_t len, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port) {
     if (len == 0) {
         printf("no payload to send, skipping transmission.\n");
+        return 0;
+    }
+    if (tcp_conn->snd_ctl & TCP_FLG_FIN) {
+        printf("connection is closing, cannot send more data.\n");
+        return 0;
+    }
+
+    size_t written = tcp_sndbuf_write(tcp_conn, data, len);
+    if (written < len)
+        printf("send buffer is full [max value = %d], %zu bytes dropped.\n", TCP_SEND_BUFFER_MAX_SIZE, len - written);
+    // 报文段按连接绑定的四元组发出，源地址不随路由变化
+    tcp_output(tcp_conn, &tcp_conn->key, false);
+    return written;
+}
+
+/**
+ * @brief 把数据写入发送缓冲区但不立即发送，同一轮中的多次小写入在本轮收包结束后（或 tcp_flush() 时）
+ *        合并为满 MSS 的报文段发送
+ *
+ * @param tcp_conn  指向当前 TCP 连接的指针
+ * @param data      要发送的数据
+ * @param len       数据长度
+ * @return size_t   写入发送缓冲区的长度，缓冲区达到上限时小于 len
+ */
+size_t tcp_write(tcp_conn_t *tcp_conn, const uint8_t *data, size_t len) {
+    if (tcp_conn->snd_ctl & TCP_FLG_FIN) {
+        printf("connection is closing, cannot send more data.\n");
+        return 0;
+    }
+    size_t written = tcp_sndbuf_write(tcp_conn, data, len);
+    if (written < len)
+        printf("send buffer is full [max value = %d], %zu bytes dropped.\n", TCP_SEND_BUFFER_MAX_SIZE, len - written);
+    if (written)
+        tcp_defer(tcp_conn, TCP_DEFER_OUTPUT);
+    return written;
+}
+
+/**
+ * @brief 立即发送 tcp_write() 写入的数据，不足 MSS 的最后一段也不再等待合并
+ *
+ * @param tcp_conn  指向当前 TCP 连接的指针
+ */
+void tcp_flush(tcp_conn_t *tcp_conn) {
+    tcp_output(tcp_conn, &tcp_conn->key, true);
+}
+
+/**
+ * @brief 主动关闭连接的发送方向：发送缓冲区中的数据发送完毕后发送 FIN，之后仍可接收对端的数据，
+ *        直到对端也关闭后连接进入 TIME_WAIT 或被释放
+ *
+ * @param tcp_conn  指向当前 TCP 连接的指针
+ */
+void tcp_shutdown(tcp_conn_t *tcp_conn) {
+    switch (tcp_conn->state) {
+        case TCP_STATE_SYN_RECEIVED:  // FIN 在 SYN 被确认后发送
+        case TCP_STATE_ESTABLISHED:
+            tcp_conn->state = TCP_STATE_FIN_WAIT1;
+            break;
+        case TCP_STATE_CLOSE_WAIT:
+            tcp_conn->state = TCP_STATE_LAST_ACK;
+            break;
+        case TCP_STATE_SYN_SENT:  // 连接尚未建立，直接放弃
+            tcp_free_connection(tcp_conn);
+            return;
+        default:  // 已经关闭过
+            return;
+    }
+    tcp_conn->snd_ctl |= TCP_FLG_FIN;
+    tcp_output(tcp_conn, &tcp_conn->key, true);
+}
+
+/**
+ * @brief 向对端发送 RST 并立即释放连接，发送缓冲区和接收缓冲区中的数据都被丢弃
+ *
+ * @param tcp_conn  指向当前 TCP 连接的指针，调用后不再有效
+ */
+void tcp_abort(tcp_conn_t *tcp_conn) {
+    if (tcp_conn->state != TCP_STATE_SYN_SENT) {  // 对端尚未分配连接时无需通知
+        buf_init(&txbuf, 0);
+        tcp_out(tcp_conn, &txbuf, tcp_conn->key.host_port, tcp_conn->key.remote_ip, tcp_conn->key.remote_port, TCP_FLG_RST | TCP_FLG_ACK);
+    }
+    tcp_free_connection(tcp_conn);
+}
+
+/**
+ * @brief 从接收缓冲区读取数据，窗口因此明显增大时立即发送窗口更新
+ *
+ * @param tcp_conn  指向当前 TCP 连接的指针，所在端口须由 tcp_open_buffered() 打开
+ * @param buf       读取的数据存放的位置
+ * @param len       最多读取的长度
+ * @return size_t   实际读取的长度，没有可读数据时为0
+ */
+size_t tcp_read(tcp_conn_t *tcp_conn, uint8_t *buf, size_t len) {
+    if (len > tcp_conn->rcv_len)
+        len = tcp_conn->rcv_len;
+    if (len == 0)
+        return 0;
+    tcp_rcvbuf_copy(tcp_conn, buf, len);
+    tcp_conn->rcv_len -= len;
+    tcp_conn->rcv_head = tcp_conn->rcv_len ? (tcp_conn->rcv_head + len) % tcp_conn->rcv_size : 0;
+
+    uint32_t cur = tcp_conn->rcv_adv - tcp_conn->ack;
+    if (tcp_conn->state != TCP_STATE_LISTEN && tcp_rcv_window(tcp_conn) != cur)
+        tcp_send_ack(tcp_conn);
+    return len;
+}
+
+/**
+ * @brief 回收长时间没有收到报文段的连接，空闲的已建立连接先发送保活探测
+ *
+ * @param tcp_conn  TCP 连接
+ * @param key       连接的四元组
+ * @return int      连接已被回收为1
+ */
+static int tcp_idle_check(tcp_conn_t *tcp_conn, tcp_key_t *key) {
+    uint64_t idle = tcp_now - tcp_conn->last_recv;
+    if (tcp_conn->state == TCP_STATE_FIN_WAIT2 && idle >= TCP_FIN_WAIT2_TIMEOUT_MS) {  // 对端迟迟不关闭
+        tcp_free_connection(tcp_conn);
+        return 1;
+    }
+    if (tcp_conn->idle_timeout && idle >= tcp_conn->idle_timeout) {
+        // 对端可能仍然存活，发送 RST 使其不再等待
+        buf_init(&txbuf, 0);
+        tcp_out(tcp_conn, &txbuf, key->host_port, key->remote_ip, key->remote_port, TCP_FLG_RST | TCP_FLG_ACK);
+        tcp_free_connection(tcp_conn);
+        return 1;
+    }
+    // 有数据在途时由重传定时器检测对端是否存活
+    if (!tcp_conn->keepalive || tcp_conn->snd_una != tcp_conn->snd_max ||
+        (tcp_conn->state != TCP_STATE_ESTABLISHED && tcp_conn->state != TCP_STATE_CLOSE_WAIT))
+        return 0;
+    if (idle < tcp_conn->keepalive + (uint64_t)tcp_conn->keepalive_probes * TCP_KEEPALIVE_INTVL_MS)
+        return 0;
+    if (tcp_conn->keepalive_probes >= TCP_KEEPALIVE_PROBES) {  // 对端已崩溃或不可达
+        tcp_free_connection(tcp_conn);
+        return 1;
+    }
+    // 保活探测：序列号为已确认的前一个字节，对端必须回复 ACK
+    buf_init(&txbuf, 0);
+    tcp_out_seq(tcp_conn, &txbuf, tcp_conn->snd_una - 1, key->host_ip, key->host_port, key->remote_ip, key->remote_port, TCP_FLG_ACK);
+    tcp_conn->keepalive_probes++;
+    return 0;
+}
+
+static void tcp_timer_fn(tcp_conn_t *tcp_conn) {
+    tcp_key_t *key = &tcp_conn->key;
+    if (tcp_conn->delack_expire && tcp_now >= tcp_conn->delack_expire)
+        tcp_send_ack(tcp_conn);
+    if (tcp_idle_check(tcp_conn, key))
+        return;
+    if (tcp_conn->rto_expire == 0 || tcp_now < tcp_conn->rto_expire)
+        return;
+    if (++tcp_conn->retries > TCP_MAX_RETRIES) {  // 对端长时间无响应，放弃连接
+        tcp_free_connection(tcp_conn);
         return;
     }
+    tcp_timeout(tcp_conn, key);
+    // 指数退避，直到获得新的 RTT 测量值
+    tcp_conn->rto = tcp_conn->rto * 2 < TCP_MAX_RTO_MS ? tcp_conn->rto * 2 : TCP_MAX_RTO_MS;
+    tcp_conn->rto_expire = tcp_now + tcp_conn->rto;
+}
 
-    // 发送数据包
-    buf_t tx_buf;
-    buf_init(&tx_buf, len);
-    if (data)
-        memcpy(tx_buf.data, data, len);
-    tcp_out(tcp_conn, &tx_buf, src_port, dst_ip, dst_port, TCP_FLG_ACK /* 顺带 ACK */);
+/**
+ * @brief 处理到期的半连接和 TIME_WAIT 表项，每个链表只检查队首，与表项总数无关
+ *
+ */
+static void tcp_expire_poll() {
+    for (uint8_t level = 0; level <= TCP_SYN_RETRIES; level++) {
+        tcp_synrecv_t *req;
+        while ((req = tcp_synrecv_head[level]) && tcp_now >= req->expire) {
+            if (req->retries == TCP_SYN_RETRIES) {  // 对端没有完成握手
+                tcp_synrecv_drop(req);
+                continue;
+            }
+            tcp_synrecv_unlink(req);
+            req->retries++;
+            tcp_synrecv_send(&req->key, req);
+            req->expire = tcp_now + ((uint64_t)TCP_RETRANSMISSON_TIMEOUT * 1000 << req->retries);
+            tcp_synrecv_append(req);
+        }
+    }
+    while (tcp_timewait_head && tcp_now >= tcp_timewait_head->expire)
+        tcp_timewait_remove(tcp_timewait_head);
+}
+
+/**
+ * @brief 每轮收包之后调用：发送推迟的数据和合并的 ACK，并按定时器间隔处理超时重传、延迟确认和 SYN-ACK 重传
+ *
+ */
+void tcp_poll() {
+    static uint64_t last;
+    tcp_defer_flush();
+    tcp_now = time_now_ms();
+    if (tcp_now - last < TCP_TIMER_TICK_MS)
+        return;
+    last = tcp_now;
+    if (tcp_conn_num)
+        tcp_conn_foreach(tcp_timer_fn);
+    if (tcp_synrecv_num || tcp_timewait_num)
+        tcp_expire_poll();
+}
 
-    // 更新序列号
-    tcp_conn->seq += bytes_in_flight(len, 0);
-    // 标注已 ACK
-    tcp_conn->not_send_empty_ack = 1;
+/**
+ * @brief 选择拥塞控制算法
+ *
+ * @param tcp_conn  要修改的连接，为NULL则修改之后新建连接的默认算法
+ * @param name      算法名称，"newreno" 或 "cubic"
+ * @return int      成功为0，找不到算法为-1
+ */
+int tcp_set_congestion_control(tcp_conn_t *tcp_conn, const char *name) {
+    const tcp_cc_ops_t *cc = tcp_cc_find(name);
+    if (cc == NULL) {
+        printf("unknown congestion control %s.\n", name);
+        return -1;
+    }
+    if (tcp_conn == NULL) {
+        tcp_cc_default = cc;
+        return 0;
+    }
+    tcp_conn->cc = cc;
+    cc->init(tcp_conn);
+    return 0;
 }
 
 /**
@@ -328,38 +2213,262 @@ void tcp_send(tcp_conn_t *tcp_conn, uint8_t *data, uint16_t len, uint16_t src_po
  *
  */
 void tcp_init() {
-    map_init(&tcp_handler_table, sizeof(uint16_t), sizeof(tcp_handler_t), 0, 0, NULL, NULL);
-    map_init(&tcp_conn_table, sizeof(tcp_key_t), sizeof(tcp_conn_t), 0, 0, NULL, NULL);
+    map_init(&tcp_handler_table, sizeof(uint16_t), sizeof(tcp_listener_t), 0, 0, NULL, NULL);
+    memset(tcp_conn_table, 0, sizeof(tcp_conn_table));
+    tcp_conn_free = NULL;
+    for (size_t i = 0; i < tcp_conn_chunk_num; i++)
+        free(tcp_conn_chunk[i]);
+    tcp_conn_chunk_num = 0;
+    tcp_conn_num = 0;
+    tcp_conn_cache = NULL;
+    memset(tcp_timewait_table, 0, sizeof(tcp_timewait_table));
+    tcp_timewait_free = NULL;
+    for (size_t i = TCP_TIMEWAIT_MAX_NUM; i-- > 0;) {
+        tcp_timewait_pool[i].hash_next = tcp_timewait_free;
+        tcp_timewait_free = &tcp_timewait_pool[i];
+    }
+    tcp_timewait_head = tcp_timewait_tail = NULL;
+    tcp_timewait_num = 0;
+    memset(tcp_synrecv_table, 0, sizeof(tcp_synrecv_table));
+    tcp_synrecv_free = NULL;
+    for (size_t i = TCP_SYNRECV_MAX_NUM; i-- > 0;) {
+        tcp_synrecv_pool[i].hash_next = tcp_synrecv_free;
+        tcp_synrecv_free = &tcp_synrecv_pool[i];
+    }
+    memset(tcp_synrecv_head, 0, sizeof(tcp_synrecv_head));
+    memset(tcp_synrecv_tail, 0, sizeof(tcp_synrecv_tail));
+    tcp_synrecv_num = 0;
     net_add_protocol(NET_PROTOCOL_TCP, tcp_in);
-    // 初始化随机数种子，为生成 TCP 初始序列号提供支持
+    tcp_ooo_free = NULL;
+    for (size_t i = 0; i < TCP_OOO_POOL_NUM; i++) {
+        tcp_ooo_pool[i].next = tcp_ooo_free;
+        tcp_ooo_free = &tcp_ooo_pool[i];
+    }
+    tcp_cc_default = tcp_cc_find(TCP_CONGESTION_CONTROL);
+    // 初始化随机数种子，为生成 TCP 初始序列号和临时端口提供支持
     srand(time(NULL));
+    tcp_port_secret = rand();
+#ifdef TEST
+    tcp_cookie_secret = 0;
+#else
+    tcp_cookie_secret = rand();
+#endif
+    tcp_conn_secret = rand();
+}
+
+/**
+ * @brief 在端口上注册监听的处理程序。端口已停止监听但仍有连接时，重新监听继承这些连接的计数
+ *
+ * @param port      端口号
+ * @param handler   处理程序
+ * @param buffered  收到的数据是否先写入接收缓冲区
+ * @return int      成功为0，失败为-1
+ */
+static int tcp_listen_open(uint16_t port, tcp_handler_t handler, uint8_t buffered) {
+    tcp_listener_t listener = {.handler = handler, .buffered = buffered, .idle_timeout = TCP_IDLE_TIMEOUT_MS};
+    tcp_listener_t *old = map_get(&tcp_handler_table, &port);
+    if (old && old->closed)
+        listener.conn_num = old->conn_num;
+    if (map_set(&tcp_handler_table, &port, &listener) < 0)
+        return -1;
+    net_port_open(NET_PROTOCOL_TCP, port);
+    return 0;
 }
 
 /**
- * @brief 打开一个 TCP 端口并注册处理程序
+ * @brief 打开一个 TCP 端口并注册处理程序，收到的数据直接交付给处理程序
  *
  * @param port      端口号
  * @param handler   处理程序
  * @return int      成功为0，失败为-1
  */
 int tcp_open(uint16_t port, tcp_handler_t handler) {
-    return map_set(&tcp_handler_table, &port, &handler);
+    return tcp_listen_open(port, handler, 0);
+}
+
+/**
+ * @brief 打开一个 TCP 端口，收到的数据写入各连接的接收缓冲区，处理程序被通知后用 tcp_read() 读取，
+ *        应用读取得慢时通告的窗口随之缩小，对端不会发送超出缓冲区的数据
+ *
+ * @param port      端口号
+ * @param handler   处理程序
+ * @return int      成功为0，失败为-1
+ */
+int tcp_open_buffered(uint16_t port, tcp_handler_t handler) {
+    return tcp_listen_open(port, handler, 1);
+}
+
+/**
+ * @brief 主动打开一个 TCP 连接：分配临时端口并发送 SYN
+ *
+ * @param dst_ip    对端 IP 地址
+ * @param dst_port  对端端口号
+ * @param handler   处理程序
+ * @param buffered  收到的数据是否先写入接收缓冲区
+ * @return tcp_conn_t*  新连接，临时端口耗尽或连接表已满时为NULL
+ */
+static tcp_conn_t *tcp_active_open(uint8_t *dst_ip, uint16_t dst_port, tcp_handler_t handler, uint8_t buffered) {
+    net_if_t *netif = net_if_route(dst_ip);
+    uint16_t port = tcp_ephemeral_port(netif->ip, dst_ip, dst_port);
+    if (port == 0) {
+        printf("no ephemeral port available.\n");
+        return NULL;
+    }
+    tcp_listener_t listener = {.handler = handler, .buffered = buffered, .active = 1, .idle_timeout = TCP_IDLE_TIMEOUT_MS};
+    if (map_set(&tcp_handler_table, &port, &listener) < 0)
+        return NULL;
+    tcp_conn_t new_conn;
+    tcp_rst(&new_conn);
+    new_conn.key = generate_tcp_key(netif->ip, dst_ip, dst_port, port);
+    tcp_conn_t *tcp_conn = tcp_conn_insert(&new_conn);
+    if (tcp_conn == NULL) {
+        map_delete(&tcp_handler_table, &port);
+        return NULL;
+    }
+    // 所有临时端口在过滤器中只占一项，不必为每个连接重新生成过滤器
+    net_port_range_open(NET_PROTOCOL_TCP, TCP_EPHEMERAL_PORT_MIN, TCP_EPHEMERAL_PORT_MAX);
+
+    // SYN 占用一个序列号，并提供本端支持的全部选项
+    tcp_conn->seq = tcp_generate_initial_seq();
+    tcp_conn->snd_una = tcp_conn->seq;
+    tcp_conn->snd_max = tcp_conn->seq;
+    tcp_conn->snd_sml = tcp_conn->seq;
+    tcp_conn->snd_ctl = TCP_FLG_SYN;
+    tcp_conn->rto = TCP_RETRANSMISSON_TIMEOUT * 1000;
+    tcp_conn->rcv_size = TCP_RECV_BUFFER_SIZE;
+    tcp_conn->rcv_wscale = TCP_WSCALE;
+    tcp_conn->sack_ok = 1;
+    tcp_conn->ts_ok = 1;
+    tcp_conn->listener = map_get(&tcp_handler_table, &port);
+    tcp_conn->idle_timeout = listener.idle_timeout;
+    tcp_conn->last_recv = time_now_ms();
+
+    tcp_conn->state = TCP_STATE_SYN_SENT;
+    tcp_output(tcp_conn, &tcp_conn->key, false);
+    return tcp_conn;
+}
+
+/**
+ * @brief 主动打开一个 TCP 连接：分配临时端口并发送 SYN，收到 SYN-ACK 后连接建立，
+ *        处理程序收到 data 为NULL、len 为0的通知后即可发送数据，之后收到的数据与 tcp_open() 一样直接交付
+ *
+ * @param dst_ip    对端 IP 地址
+ * @param dst_port  对端端口号
+ * @param handler   处理程序
+ * @return tcp_conn_t*  新连接，临时端口耗尽或连接表已满时为NULL
+ */
+tcp_conn_t *tcp_connect(uint8_t *dst_ip, uint16_t dst_port, tcp_handler_t handler) {
+    return tcp_active_open(dst_ip, dst_port, handler, 0);
+}
+
+/**
+ * @brief 主动打开一个 TCP 连接，收到的数据与 tcp_open_buffered() 一样写入接收缓冲区，由 tcp_read() 读取
+ *
+ * @param dst_ip    对端 IP 地址
+ * @param dst_port  对端端口号
+ * @param handler   处理程序
+ * @return tcp_conn_t*  新连接，临时端口耗尽或连接表已满时为NULL
+ */
+tcp_conn_t *tcp_connect_buffered(uint8_t *dst_ip, uint16_t dst_port, tcp_handler_t handler) {
+    return tcp_active_open(dst_ip, dst_port, handler, 1);
+}
+
+/**
+ * @brief 设置端口上新连接的空闲超时，超时的连接发送 RST 后被回收
+ *
+ * @param port          已打开的端口号
+ * @param timeout_ms    空闲超时（毫秒），0 表示不限
+ * @return int          成功为0，端口未打开为-1
+ */
+int tcp_set_idle_timeout(uint16_t port, uint32_t timeout_ms) {
+    tcp_listener_t *listener = map_get(&tcp_handler_table, &port);
+    if (listener == NULL)
+        return -1;
+    listener->idle_timeout = timeout_ms;
+    return 0;
+}
+
+/**
+ * @brief 设置端口上新连接的保活探测：空闲 idle_ms 后每隔 TCP_KEEPALIVE_INTVL_MS 发送一次探测，
+ *        连续 TCP_KEEPALIVE_PROBES 次无响应则回收连接
+ *
+ * @param port      已打开的端口号
+ * @param idle_ms   开始探测前的空闲时间（毫秒），0 表示不探测
+ * @return int      成功为0，端口未打开为-1
+ */
+int tcp_set_keepalive(uint16_t port, uint32_t idle_ms) {
+    tcp_listener_t *listener = map_get(&tcp_handler_table, &port);
+    if (listener == NULL)
+        return -1;
+    listener->keepalive = idle_ms;
+    return 0;
+}
+
+/**
+ * @brief 注册端口上连接状态变化的通知，与处理程序收到的数据通知一起供套接字层实现就绪通知
+ *
+ * @param port      已打开的端口号，包括 tcp_connect() 分配的临时端口
+ * @param notify    通知函数，为NULL则取消通知
+ * @return int      成功为0，端口未打开为-1
+ */
+int tcp_set_notify(uint16_t port, tcp_notify_t notify) {
+    tcp_listener_t *listener = map_get(&tcp_handler_table, &port);
+    if (listener == NULL)
+        return -1;
+    listener->notify = notify;
+    return 0;
 }
 
 static _Thread_local uint16_t close_port;
-static void close_port_fn(void *key, void *value, time_t *timestamp) {
-    tcp_key_t *tcp_key = key;
-    if (tcp_key->host_port == close_port) {
-        map_delete(&tcp_conn_table, key);
+static void close_port_fn(tcp_conn_t *tcp_conn) {
+    if (tcp_conn->key.host_port == close_port)
+        tcp_free_connection(tcp_conn);
+}
+/**
+ * @brief 丢弃端口上的所有半连接
+ *
+ * @param port  端口号
+ */
+static void tcp_synrecv_close(uint16_t port) {
+    for (uint8_t level = 0; level <= TCP_SYN_RETRIES; level++) {  // 到期链表包含所有半连接
+        tcp_synrecv_t *req = tcp_synrecv_head[level];
+        while (req) {
+            tcp_synrecv_t *next = req->timer_next;
+            if (req->key.host_port == port)
+                tcp_synrecv_drop(req);
+            req = next;
+        }
     }
 }
+
 /**
  * @brief 关闭一个 TCP 端口
  */
 void tcp_close(uint16_t port) {
     close_port = port;
-    map_foreach(&tcp_conn_table, close_port_fn);
+    tcp_conn_foreach(close_port_fn);
+    tcp_synrecv_close(port);
+    map_delete(&tcp_handler_table, &port);
+    net_port_close(NET_PROTOCOL_TCP, port);
+}
+
+/**
+ * @brief 停止在端口上接受连接：丢弃半连接，之后的连接请求不再应答；
+ *        已建立的连接不受影响，仍由原处理程序处理，端口在其上最后一个连接释放时关闭
+ *
+ * @param port  端口号
+ */
+void tcp_unlisten(uint16_t port) {
+    tcp_listener_t *listener = map_get(&tcp_handler_table, &port);
+    if (listener == NULL || listener->active)
+        return;
+    tcp_synrecv_close(port);
+    if (listener->conn_num) {
+        listener->closed = 1;
+        return;
+    }
     map_delete(&tcp_handler_table, &port);
+    net_port_close(NET_PROTOCOL_TCP, port);
 }
 
 /* =============================== COMMON API =============================== */
\ No newline at end of file
@@ -0,0 +1,160 @@
+#include "tcp.h"
+
+#include <string.h>
+
+/* =============================== NewReno =============================== */
+
+typedef struct tcp_newreno {
+    uint32_t acked_cnt;  // 拥塞避免阶段累计确认的字节数（RFC 3465）
+} tcp_newreno_t;
+
+static void tcp_newreno_init(tcp_conn_t *tcp_conn) {
+    memset(tcp_conn->cc_priv, 0, sizeof(tcp_conn->cc_priv));
+}
+
+/**
+ * @brief 拥塞避免：每确认一个拥塞窗口的数据，窗口增加一个 MSS
+ *
+ */
+static void tcp_newreno_cong_avoid(tcp_conn_t *tcp_conn, uint32_t acked) {
+    tcp_newreno_t *ca = (tcp_newreno_t *)tcp_conn->cc_priv;
+    ca->acked_cnt += acked;
+    if (ca->acked_cnt >= tcp_conn->cwnd) {
+        ca->acked_cnt -= tcp_conn->cwnd;
+        tcp_conn->cwnd += tcp_conn->smss;
+    }
+}
+
+/**
+ * @brief 丢包时慢启动阈值减为在途数据量的一半，且不少于两个 MSS（RFC 5681 式 4）
+ *
+ */
+static uint32_t tcp_newreno_ssthresh(tcp_conn_t *tcp_conn) {
+    uint32_t flight = tcp_conn->snd_max - tcp_conn->snd_una;
+    return flight / 2 > 2u * tcp_conn->smss ? flight / 2 : 2u * tcp_conn->smss;
+}
+
+const tcp_cc_ops_t tcp_cc_newreno = {
+    .name = "newreno",
+    .init = tcp_newreno_init,
+    .cong_avoid = tcp_newreno_cong_avoid,
+    .ssthresh = tcp_newreno_ssthresh,
+};
+
+/* =============================== CUBIC =============================== */
+
+#define TCP_CUBIC_C 0.4     // 三次函数的缩放常数
+#define TCP_CUBIC_BETA 0.7  // 乘性减小因子
+
+typedef struct tcp_cubic {  // 窗口以 MSS 为单位，时间以秒为单位（RFC 9438）
+    double w_max;            // 上次丢包前的窗口
+    double k;                // 窗口回到 w_max 所需的时间
+    double origin;           // 三次函数的中心点
+    double w_est;            // 按 Reno 方式估计的窗口，用于 TCP 友好区间
+    double cwnd_frac;        // 不足一个字节的窗口增量
+    uint64_t epoch_start;    // 本轮拥塞避免开始的时间（毫秒），0 表示尚未开始
+} tcp_cubic_t;
+
+_Static_assert(sizeof(tcp_cubic_t) <= sizeof(((tcp_conn_t *)0)->cc_priv), "cubic state too large");
+
+/**
+ * @brief 牛顿迭代求立方根，避免链接数学库
+ *
+ * @param x 非负数
+ * @return double 立方根
+ */
+static double tcp_cubic_cbrt(double x) {
+    if (x <= 0)
+        return 0;
+    double y = x > 1 ? x / 3 : 1;
+    for (int i = 0; i < 100; i++) {
+        double next = (2 * y + x / (y * y)) / 3;
+        if (next >= y - 1e-9 && next <= y + 1e-9)
+            return next;
+        y = next;
+    }
+    return y;
+}
+
+static void tcp_cubic_init(tcp_conn_t *tcp_conn) {
+    memset(tcp_conn->cc_priv, 0, sizeof(tcp_conn->cc_priv));
+}
+
+/**
+ * @brief 拥塞避免：窗口沿三次函数增长，且不慢于同等条件下的 Reno
+ *
+ */
+static void tcp_cubic_cong_avoid(tcp_conn_t *tcp_conn, uint32_t acked) {
+    tcp_cubic_t *ca = (tcp_cubic_t *)tcp_conn->cc_priv;
+    double cwnd = (double)tcp_conn->cwnd / tcp_conn->smss;
+    uint64_t now = time_now_ms();
+    if (ca->epoch_start == 0) {
+        ca->epoch_start = now;
+        if (cwnd < ca->w_max) {
+            ca->k = tcp_cubic_cbrt((ca->w_max - cwnd) / TCP_CUBIC_C);
+            ca->origin = ca->w_max;
+        } else {
+            ca->k = 0;
+            ca->origin = cwnd;
+        }
+        ca->w_est = cwnd;
+    }
+
+    // 预测一个 RTT 之后的窗口
+    double t = (now - ca->epoch_start + tcp_conn->srtt) / 1000.0 - ca->k;
+    double target = ca->origin + TCP_CUBIC_C * t * t * t;
+    if (target < cwnd)
+        target = cwnd;
+    else if (target > 1.5 * cwnd)
+        target = 1.5 * cwnd;
+
+    // TCP 友好区间
+    ca->w_est += 3 * (1 - TCP_CUBIC_BETA) / (1 + TCP_CUBIC_BETA) * ((double)acked / tcp_conn->smss) / cwnd;
+    if (ca->w_est > target)
+        target = ca->w_est;
+
+    ca->cwnd_frac += (target - cwnd) / cwnd * acked;
+    if (ca->cwnd_frac >= 1) {
+        uint32_t inc = (uint32_t)ca->cwnd_frac;
+        tcp_conn->cwnd += inc;
+        ca->cwnd_frac -= inc;
+    }
+}
+
+/**
+ * @brief 丢包时记录 w_max 并乘性减小，窗口仍在增长前就再次丢包时进一步让出带宽（快速收敛）
+ *
+ */
+static uint32_t tcp_cubic_ssthresh(tcp_conn_t *tcp_conn) {
+    tcp_cubic_t *ca = (tcp_cubic_t *)tcp_conn->cc_priv;
+    double cwnd = (double)tcp_conn->cwnd / tcp_conn->smss;
+    ca->w_max = cwnd < ca->w_max ? cwnd * (1 + TCP_CUBIC_BETA) / 2 : cwnd;
+    ca->epoch_start = 0;
+    ca->cwnd_frac = 0;
+    uint32_t ssthresh = tcp_conn->cwnd * TCP_CUBIC_BETA;
+    return ssthresh > 2u * tcp_conn->smss ? ssthresh : 2u * tcp_conn->smss;
+}
+
+const tcp_cc_ops_t tcp_cc_cubic = {
+    .name = "cubic",
+    .init = tcp_cubic_init,
+    .cong_avoid = tcp_cubic_cong_avoid,
+    .ssthresh = tcp_cubic_ssthresh,
+};
+
+/* =============================== registry =============================== */
+
+static const tcp_cc_ops_t *tcp_cc_list[] = {&tcp_cc_newreno, &tcp_cc_cubic};
+
+/**
+ * @brief 按名称查找拥塞控制算法
+ *
+ * @param name 算法名称
+ * @return const tcp_cc_ops_t* 找不到为NULL
+ */
+const tcp_cc_ops_t *tcp_cc_find(const char *name) {
+    for (size_t i = 0; i < sizeof(tcp_cc_list) / sizeof(tcp_cc_list[0]); i++)
+        if (strcmp(tcp_cc_list[i]->name, name) == 0)
+            return tcp_cc_list[i];
+    return NULL;
+}
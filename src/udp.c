@@ -8,6 +8,12 @@
  *
  */
 map_t udp_table;
+/**
+ * @brief 正在处理的数据报的目的地址和源地址，处理函数中发给该源地址的应答以该目的地址为源地址
+ *
+ */
+static uint8_t *udp_reply_ip;
+static uint8_t *udp_reply_peer;
 
 /**
  * @brief 处理一个收到的udp数据包
@@ -34,7 +40,7 @@ void udp_in(buf_t *buf, uint8_t *src_ip) {
     uint16_t received_checksum = hdr->checksum16;  // 保存原校验和
     hdr->checksum16 = 0;  // 将校验和字段填充为0
     
-    uint16_t calculated_checksum = transport_checksum(NET_PROTOCOL_UDP, buf, src_ip, net_if_ip);
+    uint16_t calculated_checksum = transport_checksum(NET_PROTOCOL_UDP, buf, src_ip, buf->netif->ip);
     
     if (received_checksum != calculated_checksum) {
         // 校验和不一致，丢弃数据报
@@ -60,7 +66,10 @@ void udp_in(buf_t *buf, uint8_t *src_ip) {
     // 去掉UDP报头
     buf_remove_header(buf, sizeof(udp_hdr_t));
     // 调用处理函数
+    udp_reply_ip = buf->netif->ip;
+    udp_reply_peer = src_ip;
     (*handler)(buf->data, buf->len, src_ip, src_port);
+    udp_reply_ip = udp_reply_peer = NULL;
 }
 
 /**
@@ -82,11 +91,13 @@ void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dst_ip, uint16_t dst_port)
     hdr->total_len16 = swap16(buf->len);     // 整个UDP数据报长度（网络字节序）
     
     /* Step3: 计算并填充校验和 */
+    // 应答使用所收数据报的目的地址，其他数据报按路由选择源地址
+    uint8_t *src_ip = udp_reply_peer && memcmp(dst_ip, udp_reply_peer, NET_IP_LEN) == 0 ? udp_reply_ip : NULL;
     hdr->checksum16 = 0;  // 先填充为0
-    hdr->checksum16 = transport_checksum(NET_PROTOCOL_UDP, buf, net_if_ip, dst_ip);
+    hdr->checksum16 = transport_checksum(NET_PROTOCOL_UDP, buf, net_if_select(src_ip, dst_ip)->ip, dst_ip);
     
     /* Step4: 发送 UDP 数据报 */
-    ip_out(buf, dst_ip, NET_PROTOCOL_UDP);
+    ip_out_from(buf, src_ip, dst_ip, NET_PROTOCOL_UDP);
 }
 
 /**
@@ -106,7 +117,10 @@ void udp_init() {
  * @return int 成功为0，失败为-1
  */
 int udp_open(uint16_t port, udp_handler_t handler) {
-    return map_set(&udp_table, &port, &handler);
+    if (map_set(&udp_table, &port, &handler) < 0)
+        return -1;
+    net_port_open(NET_PROTOCOL_UDP, port);
+    return 0;
 }
 
 /**
@@ -116,6 +130,7 @@ int udp_open(uint16_t port, udp_handler_t handler) {
  */
 void udp_close(uint16_t port) {
     map_delete(&udp_table, &port);
+    net_port_close(NET_PROTOCOL_UDP, port);
 }
 
 /**
@@ -4,6 +4,9 @@
 
 #include <stdio.h>
 #include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
 /**
  * @brief ip转字符串
  *
@@ -41,6 +44,21 @@ char *timetos(time_t timestamp) {
     return output;
 }
 
+/**
+ * @brief 获取单调递增的毫秒时间，用于协议定时器
+ *
+ * @return uint64_t 毫秒数，起点不确定，只用于计算时间差
+ */
+uint64_t time_now_ms() {
+#ifdef _WIN32
+    return GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
 /**
  * @brief ip前缀匹配
  *
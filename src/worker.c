@@ -0,0 +1,551 @@
+#include "worker.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum worker_msg_type {
+    WORKER_MSG_DATA,      // 协议栈 -> 工作线程：收到的数据，长度为0表示对端已关闭
+    WORKER_MSG_SEND,      // 工作线程 -> 协议栈：要发送的数据
+    WORKER_MSG_SHUTDOWN,  // 工作线程 -> 协议栈：之前的数据发送完毕后关闭连接
+} worker_msg_type_t;
+
+typedef struct worker_msg {
+    struct worker_msg *next;   // 连接上等待写入发送缓冲区的响应队列
+    worker_msg_type_t type;
+    uint32_t conn;             // 连接句柄
+    worker_handler_t handler;  // 处理该连接的应用回调
+    size_t len;
+    size_t off;                // 已写入发送缓冲区的长度
+    uint8_t data[];
+} worker_msg_t;
+
+typedef struct worker_spsc {  // 单生产者单消费者环形队列，协议栈线程写入，一个工作线程读取
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t head;  // 只由消费者修改
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t tail;  // 只由生产者修改
+    worker_msg_t *slots[WORKER_RING_SIZE];
+} worker_spsc_t;
+
+typedef struct worker_mpsc_slot {
+    _Atomic size_t seq;  // 等于写入位置时可写，等于写入位置+1时可读
+    worker_msg_t *msg;
+} worker_mpsc_slot_t;
+
+typedef struct worker_mpsc {  // 多生产者单消费者环形队列，工作线程竞争写入位置，协议栈线程读取
+    _Alignas(CACHE_LINE_SIZE) _Atomic size_t tail;
+    _Alignas(CACHE_LINE_SIZE) size_t head;  // 只由协议栈线程访问
+    worker_mpsc_slot_t slots[WORKER_REPLY_RING_SIZE];
+} worker_mpsc_t;
+
+typedef struct worker {
+    pthread_t thread;
+    worker_spsc_t ring;
+    /* 队列为空时线程在条件变量上睡眠，生产者只在 sleeping 置位时才加锁唤醒 */
+    _Alignas(CACHE_LINE_SIZE) _Atomic int sleeping;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} worker_t;
+
+typedef struct worker_conn {  // 只由协议栈线程访问
+    tcp_conn_t *tcp_conn;     // 为NULL时空闲
+    worker_handler_t handler;
+    uint16_t gen;             // 每次释放加一，使旧句柄失效
+    uint8_t pending;          // 接收队列已满，接收缓冲区中的数据等待再次分发
+    uint8_t eof;              // 已通知应用对端关闭
+    worker_msg_t *out_head;   // 发送缓冲区已满时未能写入的响应
+    worker_msg_t *out_tail;
+    int next;                 // 空闲链表的下一个
+} worker_conn_t;
+
+/**
+ * @brief 工作线程表，worker_num 为0时应用回调直接在协议栈线程中执行
+ *
+ */
+static worker_t worker_table[WORKER_MAX_NUM];
+static int worker_num;
+static _Atomic int worker_stop;
+/**
+ * @brief 工作线程发回协议栈线程的响应队列
+ *
+ */
+static worker_mpsc_t worker_reply_ring;
+/**
+ * @brief 连接表及其空闲链表，句柄的低16位为下标，高16位为分配时的 gen
+ *
+ */
+static worker_conn_t worker_conn_table[TCP_MAX_CONN_NUM];
+_Static_assert(TCP_MAX_CONN_NUM <= 0x10000, "worker connection handle holds a 16-bit index");
+static int worker_conn_free;
+static int worker_pending_num;
+/**
+ * @brief 端口对应的应用回调
+ *
+ */
+static map_t worker_handler_table;  // port -> worker_handler_t
+
+static int worker_spsc_empty(worker_spsc_t *ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire) ==
+           atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+static int worker_spsc_full(worker_spsc_t *ring) {
+    return atomic_load_explicit(&ring->tail, memory_order_relaxed) -
+               atomic_load_explicit(&ring->head, memory_order_acquire) ==
+           WORKER_RING_SIZE;
+}
+
+/**
+ * @brief 写入单生产者队列，调用者需先用 worker_spsc_full() 确认有空位
+ *
+ */
+static void worker_spsc_push(worker_spsc_t *ring, worker_msg_t *msg) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    ring->slots[tail & (WORKER_RING_SIZE - 1)] = msg;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+static worker_msg_t *worker_spsc_pop(worker_spsc_t *ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&ring->tail, memory_order_acquire))
+        return NULL;
+    worker_msg_t *msg = ring->slots[head & (WORKER_RING_SIZE - 1)];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return msg;
+}
+
+/**
+ * @brief 写入多生产者队列，生产者通过 CAS 占用写入位置，每个槽位的序号保证读取时数据已写完
+ *
+ * @return int  成功为0，队列已满为-1
+ */
+static int worker_mpsc_push(worker_mpsc_t *ring, worker_msg_t *msg) {
+    size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    worker_mpsc_slot_t *slot;
+    for (;;) {
+        slot = &ring->slots[pos & (WORKER_REPLY_RING_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+    slot->msg = msg;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return 0;
+}
+
+static worker_msg_t *worker_mpsc_pop(worker_mpsc_t *ring) {
+    size_t pos = ring->head;
+    worker_mpsc_slot_t *slot = &ring->slots[pos & (WORKER_REPLY_RING_SIZE - 1)];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1)
+        return NULL;
+    worker_msg_t *msg = slot->msg;
+    atomic_store_explicit(&slot->seq, pos + WORKER_REPLY_RING_SIZE, memory_order_release);
+    ring->head = pos + 1;
+    return msg;
+}
+
+static worker_msg_t *worker_msg_new(worker_msg_type_t type, uint32_t conn, size_t len) {
+    worker_msg_t *msg = malloc(sizeof(worker_msg_t) + len);
+    if (msg == NULL)
+        return NULL;
+    msg->next = NULL;
+    msg->type = type;
+    msg->conn = conn;
+    msg->handler = NULL;
+    msg->len = len;
+    msg->off = 0;
+    return msg;
+}
+
+/**
+ * @brief 生产者写入后唤醒睡眠的工作线程，与 worker_main() 中的屏障配对，不会错过唤醒
+ *
+ * @param w 工作线程
+ */
+static void worker_wake(worker_t *w) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&w->sleeping, memory_order_relaxed)) {
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+/**
+ * @brief 工作线程主循环，依次处理接收队列中的数据
+ *
+ * @param arg   工作线程
+ */
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    for (;;) {
+        worker_msg_t *msg = worker_spsc_pop(&w->ring);
+        if (msg) {
+            msg->handler(msg->conn, msg->data, msg->len);
+            free(msg);
+            continue;
+        }
+        if (atomic_load(&worker_stop))
+            break;
+        pthread_mutex_lock(&w->lock);
+        atomic_store_explicit(&w->sleeping, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        while (worker_spsc_empty(&w->ring) && !atomic_load(&worker_stop))
+            pthread_cond_wait(&w->cond, &w->lock);
+        atomic_store_explicit(&w->sleeping, 0, memory_order_relaxed);
+        pthread_mutex_unlock(&w->lock);
+    }
+    return NULL;
+}
+
+static inline uint32_t worker_conn_handle(worker_conn_t *c) {
+    return (uint32_t)c->gen << 16 | (uint32_t)(c - worker_conn_table);
+}
+
+/**
+ * @brief 根据句柄查找连接
+ *
+ * @param conn              连接句柄
+ * @return worker_conn_t*   连接已释放时为NULL
+ */
+static worker_conn_t *worker_conn_get(uint32_t conn) {
+    uint32_t idx = conn & 0xffff;
+    if (idx >= TCP_MAX_CONN_NUM)
+        return NULL;
+    worker_conn_t *c = &worker_conn_table[idx];
+    if (c->tcp_conn == NULL || c->gen != conn >> 16)
+        return NULL;
+    return c;
+}
+
+/**
+ * @brief 连接释放，丢弃尚未发送的响应，之后工作线程对该句柄的调用被忽略
+ *
+ * @param c 连接
+ */
+static void worker_conn_release(worker_conn_t *c) {
+    while (c->out_head) {
+        worker_msg_t *msg = c->out_head;
+        c->out_head = msg->next;
+        free(msg);
+    }
+    if (c->pending)
+        worker_pending_num--;
+    c->tcp_conn->user = NULL;
+    c->tcp_conn = NULL;
+    c->handler = NULL;
+    c->out_tail = NULL;
+    c->pending = 0;
+    c->eof = 0;
+    c->gen++;
+    c->next = worker_conn_free;
+    worker_conn_free = c - worker_conn_table;
+}
+
+/**
+ * @brief 把等待中的响应依次写入发送缓冲区，缓冲区达到上限时停下，等待对端确认后继续
+ *
+ * @param c 连接
+ */
+static void worker_conn_output(worker_conn_t *c) {
+    uint32_t handle = worker_conn_handle(c);
+    while (c->out_head) {
+        worker_msg_t *msg = c->out_head;
+        tcp_conn_t *tcp_conn = c->tcp_conn;
+        if (msg->type == WORKER_MSG_SHUTDOWN) {
+            if (!(tcp_conn->snd_ctl & TCP_FLG_FIN))
+                tcp_shutdown(tcp_conn);
+            if (worker_conn_get(handle) != c)  // 连接已被释放
+                return;
+        } else if (!(tcp_conn->snd_ctl & TCP_FLG_FIN)) {  // 关闭之后的数据被丢弃
+            if (tcp_conn->snd_len >= WORKER_SEND_BUFFER_SIZE)
+                return;
+            size_t room = WORKER_SEND_BUFFER_SIZE - tcp_conn->snd_len;
+            size_t len = msg->len - msg->off < room ? msg->len - msg->off : room;
+            msg->off += tcp_write(tcp_conn, msg->data + msg->off, len);
+            if (msg->off < msg->len)
+                return;
+        }
+        c->out_head = msg->next;
+        if (c->out_head == NULL)
+            c->out_tail = NULL;
+        free(msg);
+    }
+}
+
+/**
+ * @brief 处理工作线程发回的响应，按顺序排在连接已有的响应之后
+ *
+ * @param msg   响应
+ */
+static void worker_reply_in(worker_msg_t *msg) {
+    worker_conn_t *c = worker_conn_get(msg->conn);
+    if (c == NULL) {
+        free(msg);
+        return;
+    }
+    if (c->out_tail)
+        c->out_tail->next = msg;
+    else
+        c->out_head = msg;
+    c->out_tail = msg;
+    worker_conn_output(c);
+}
+
+/**
+ * @brief 把响应交给协议栈线程，队列已满时等待协议栈线程取走
+ *
+ * @param msg   响应
+ */
+static void worker_reply(worker_msg_t *msg) {
+    if (worker_num == 0) {  // 应用回调就在协议栈线程中执行
+        worker_reply_in(msg);
+        return;
+    }
+    while (worker_mpsc_push(&worker_reply_ring, msg) < 0)
+        sched_yield();
+}
+
+static inline int worker_peer_closed(tcp_conn_t *tcp_conn) {
+    return tcp_conn->state == TCP_STATE_CLOSE_WAIT || tcp_conn->state == TCP_STATE_CLOSING ||
+           tcp_conn->state == TCP_STATE_LAST_ACK || tcp_conn->state == TCP_STATE_TIME_WAIT;
+}
+
+/**
+ * @brief 把接收缓冲区中的数据分发给连接对应的工作线程。接收队列已满时数据留在接收缓冲区，
+ *        窗口随之关闭，由 worker_poll() 稍后重试
+ *
+ * @param c 连接
+ */
+static void worker_dispatch(worker_conn_t *c) {
+    tcp_conn_t *tcp_conn = c->tcp_conn;
+    uint32_t handle = worker_conn_handle(c);
+
+    if (worker_num == 0) {  // 直接在协议栈线程中执行应用回调
+        static uint8_t buf[WORKER_MSG_MAX_LEN];  // 只在协议栈线程中使用，不占用栈空间
+        while (!c->eof) {
+            size_t len = tcp_read(tcp_conn, buf, sizeof(buf));
+            if (len == 0) {
+                if (!worker_peer_closed(tcp_conn))
+                    return;
+                c->eof = 1;
+            }
+            c->handler(handle, buf, len);
+            if (worker_conn_get(handle) != c)  // 回调中连接被释放
+                return;
+        }
+        return;
+    }
+
+    // 同一连接总是交给同一个工作线程，保证数据按顺序处理
+    worker_t *w = &worker_table[(c - worker_conn_table) % worker_num];
+    int pushed = 0;
+    while (!c->eof) {
+        size_t len = tcp_conn->rcv_len < WORKER_MSG_MAX_LEN ? tcp_conn->rcv_len : WORKER_MSG_MAX_LEN;
+        if (len == 0 && !worker_peer_closed(tcp_conn))
+            break;
+        worker_msg_t *msg = worker_spsc_full(&w->ring) ? NULL : worker_msg_new(WORKER_MSG_DATA, handle, len);
+        if (msg == NULL) {
+            if (!c->pending) {
+                c->pending = 1;
+                worker_pending_num++;
+            }
+            break;
+        }
+        msg->handler = c->handler;
+        msg->len = tcp_read(tcp_conn, msg->data, len);
+        if (msg->len == 0)
+            c->eof = 1;
+        worker_spsc_push(&w->ring, msg);
+        pushed = 1;
+    }
+    if (pushed)
+        worker_wake(w);
+}
+
+/**
+ * @brief 连接的接收缓冲区中有新数据或对端关闭，首次调用时为连接分配句柄
+ *
+ */
+static void worker_tcp_handler(tcp_conn_t *tcp_conn, uint8_t *data, size_t len, uint8_t *src_ip, uint16_t src_port) {
+    worker_conn_t *c = tcp_conn->user;
+    if (c == NULL) {
+        worker_handler_t *handler = map_get(&worker_handler_table, &tcp_conn->key.host_port);
+        if (handler == NULL || worker_conn_free < 0) {
+            tcp_shutdown(tcp_conn);
+            return;
+        }
+        c = &worker_conn_table[worker_conn_free];
+        worker_conn_free = c->next;
+        c->tcp_conn = tcp_conn;
+        c->handler = *handler;
+        c->next = -1;
+        tcp_conn->user = c;
+    }
+    worker_dispatch(c);
+}
+
+/**
+ * @brief 连接状态变化的通知：发送缓冲区腾出空间时继续写入响应，连接释放时回收句柄
+ *
+ * @param tcp_conn  TCP 连接
+ * @param events    发生的事件（TCP_EVENT_*）
+ */
+static void worker_tcp_notify(tcp_conn_t *tcp_conn, uint8_t events) {
+    worker_conn_t *c = tcp_conn->user;
+    if (c == NULL)
+        return;
+    if (events & TCP_EVENT_CLOSE)
+        worker_conn_release(c);
+    else if (events & TCP_EVENT_WRITE)
+        worker_conn_output(c);
+}
+
+/**
+ * @brief 初始化工作线程池，需在 net_init 之后调用
+ *
+ * @param num   工作线程数，为0时应用回调直接在协议栈线程中执行
+ * @return int  成功为0，失败为-1
+ */
+int worker_init(int num) {
+    if (num < 0 || num > WORKER_MAX_NUM) {
+        errno = EINVAL;
+        return -1;
+    }
+    map_init(&worker_handler_table, sizeof(uint16_t), sizeof(worker_handler_t), 0, 0, NULL, NULL);
+    worker_conn_free = -1;
+    for (int i = TCP_MAX_CONN_NUM - 1; i >= 0; i--) {
+        worker_conn_table[i] = (worker_conn_t){.gen = worker_conn_table[i].gen, .next = worker_conn_free};
+        worker_conn_free = i;
+    }
+    worker_pending_num = 0;
+    atomic_store(&worker_reply_ring.tail, 0);
+    worker_reply_ring.head = 0;
+    for (size_t i = 0; i < WORKER_REPLY_RING_SIZE; i++)
+        atomic_store(&worker_reply_ring.slots[i].seq, i);
+
+    atomic_store(&worker_stop, 0);
+    worker_num = 0;
+    for (int i = 0; i < num; i++) {
+        worker_t *w = &worker_table[i];
+        atomic_store(&w->ring.head, 0);
+        atomic_store(&w->ring.tail, 0);
+        atomic_store(&w->sleeping, 0);
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->cond, NULL);
+        if (pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+            pthread_mutex_destroy(&w->lock);
+            pthread_cond_destroy(&w->cond);
+            worker_exit();
+            return -1;
+        }
+        worker_num++;
+    }
+    return 0;
+}
+
+/**
+ * @brief 打开端口，端口上连接收到的数据交给工作线程处理
+ *
+ * @param port      端口号
+ * @param handler   应用回调，在工作线程中执行
+ * @return int      成功为0，失败为-1
+ */
+int worker_open(uint16_t port, worker_handler_t handler) {
+    if (map_set(&worker_handler_table, &port, &handler) < 0)
+        return -1;
+    if (tcp_open_buffered(port, worker_tcp_handler) < 0) {
+        map_delete(&worker_handler_table, &port);
+        return -1;
+    }
+    tcp_set_notify(port, worker_tcp_notify);
+    return 0;
+}
+
+/**
+ * @brief 在协议栈线程的主循环中与 net_poll 交替调用：发送工作线程的响应，重试因队列已满而推迟的分发
+ *
+ */
+void worker_poll() {
+    worker_msg_t *msg;
+    while ((msg = worker_mpsc_pop(&worker_reply_ring)))
+        worker_reply_in(msg);
+    if (worker_pending_num == 0)
+        return;
+    for (int i = 0; i < TCP_MAX_CONN_NUM && worker_pending_num; i++) {
+        worker_conn_t *c = &worker_conn_table[i];
+        if (!c->pending)
+            continue;
+        c->pending = 0;
+        worker_pending_num--;
+        worker_dispatch(c);
+    }
+}
+
+/**
+ * @brief 停止并回收所有工作线程，尚未处理的数据被丢弃，之后应用回调在协议栈线程中执行
+ *
+ */
+void worker_exit() {
+    atomic_store(&worker_stop, 1);
+    for (int i = 0; i < worker_num; i++) {
+        worker_t *w = &worker_table[i];
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+    for (int i = 0; i < worker_num; i++) {
+        worker_t *w = &worker_table[i];
+        pthread_join(w->thread, NULL);
+        worker_msg_t *msg;
+        while ((msg = worker_spsc_pop(&w->ring)))
+            free(msg);
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+    }
+    worker_num = 0;
+    worker_poll();  // 线程已退出，剩余的响应直接处理
+}
+
+/**
+ * @brief 发送数据，可在工作线程中调用。数据复制后交给协议栈线程写入连接
+ *
+ * @param conn  连接句柄
+ * @param data  要发送的数据
+ * @param len   数据长度
+ * @return int  成功为0，无法分配内存时为-1；连接已释放时数据被丢弃
+ */
+int worker_send(uint32_t conn, const void *data, size_t len) {
+    if (len == 0)
+        return 0;
+    worker_msg_t *msg = worker_msg_new(WORKER_MSG_SEND, conn, len);
+    if (msg == NULL)
+        return -1;
+    memcpy(msg->data, data, len);
+    worker_reply(msg);
+    return 0;
+}
+
+/**
+ * @brief 关闭连接的发送方向，之前 worker_send() 的数据发送完毕后发送 FIN，可在工作线程中调用
+ *
+ * @param conn  连接句柄
+ * @return int  成功为0，无法分配内存时为-1
+ */
+int worker_shutdown(uint32_t conn) {
+    worker_msg_t *msg = worker_msg_new(WORKER_MSG_SHUTDOWN, conn, 0);
+    if (msg == NULL)
+        return -1;
+    worker_reply(msg);
+    return 0;
+}
@@ -42,7 +42,7 @@ int main(int argc, char *argv[]) {
     net_init();
     int i = 1;
     PRINT_INFO("Feeding input %02d", i);
-    while ((ret = driver_recv(&buf)) > 0) {
+    while ((ret = driver_recv(net_if_get(0), &buf)) > 0) {
         printf("\b\b%02d", i);
         fprintf(control_flow, "\nRound %02d -----------------------------\n", i++);
         buf_copy(&buf2, &buf, 0);
@@ -56,7 +56,7 @@ int main(int argc, char *argv[]) {
     if (ret < 0) {
         PRINT_WARN("\nError occur on loading input,exiting\n");
     }
-    driver_close();
+    driver_close(net_if_get(0));
     PRINT_INFO("\nSample input all processed, checking output\n");
 
     fclose(control_flow);
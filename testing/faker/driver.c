@@ -1,5 +1,4 @@
-#include "buf.h"
-#include "config.h"
+#include "driver.h"
 
 #include <pcap.h>
 #include <string.h>
@@ -31,7 +30,7 @@ BOOL LoadNpcapDlls() {
 }
 #endif
 
-int driver_open() {
+int driver_open(net_if_t *netif) {
 #ifdef _WIN32
     /* Load Npcap and its functions. */
     if (!LoadNpcapDlls()) {
@@ -55,7 +54,18 @@ int driver_open() {
     return 0;
 }
 
-int driver_recv(buf_t *buf) {
+int driver_set_filter(net_if_t *netif) {
+    return 0;
+}
+
+int driver_stats(net_if_t *netif) {
+    return 0;
+}
+
+void driver_print_stats(net_if_t *netif) {
+}
+
+int driver_recv(net_if_t *netif, buf_t *buf) {
     struct pcap_pkthdr *pkt_hdr;
     const uint8_t *pkt_data;
     int ret = pcap_next_ex(pcap, &pkt_hdr, &pkt_data);
@@ -65,6 +75,7 @@ int driver_recv(buf_t *buf) {
     } else if (ret == 1) {
         buf_init(buf, pkt_hdr->len);
         memcpy(buf->data, pkt_data, pkt_hdr->len);
+        buf->netif = netif;
         return pkt_hdr->len;
     } else {
         fprintf(stderr, "Error in driver_recv: %s\n", pcap_geterr(pcap));
@@ -72,7 +83,7 @@ int driver_recv(buf_t *buf) {
     }
 }
 
-int driver_send(buf_t *buf) {
+int driver_send(net_if_t *netif, buf_t *buf) {
     struct pcap_pkthdr header;
     memset(&header.ts, 0, sizeof(header.ts));
     header.caplen = buf->len;
@@ -81,7 +92,7 @@ int driver_send(buf_t *buf) {
     return 0;
 }
 
-void driver_close() {
+void driver_close(net_if_t *netif) {
     fprintf(control_flow, "\ndriver closed\n");
     pcap_dump_close(pdump);
     pcap_close(pcap);
@@ -35,6 +35,10 @@ void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol) {
     fprint_buf(ip_fout, buf);
 }
 
+void ip_out_from(buf_t *buf, uint8_t *src_ip, uint8_t *ip, net_protocol_t protocol) {
+    ip_out(buf, ip, protocol);
+}
+
 void ip_init() {
     net_add_protocol(NET_PROTOCOL_IP, ip_in);
 }
\ No newline at end of file
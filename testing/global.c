@@ -1,6 +1,8 @@
 #include "arp.h"
+#include "ethernet.h"
 #include "ip.h"
 #include "tcp.h"
+#include "udp.h"
 #include "map.h"
 #include "testing/log.h"
 #include "utils.h"
@@ -35,6 +37,8 @@ FILE *tcp_fout;
 FILE *out_log;
 FILE *demo_log;
 
+int pcap_check_checksum;  // 为1时还检查用户输出的校验和，下层协议的测试会原样转发伪造的上层报文，不能检查
+
 extern map_t arp_table;
 extern map_t arp_buf;
 
@@ -318,6 +322,41 @@ int _check_pcap(int idx, const uint8_t *pkt_data0, const uint8_t *pkt_data1, str
     return 0;
 }
 
+/**
+ * @brief 检查用户输出的 IP 首部校验和，以及未分片的 TCP、UDP 校验和。
+ *        与 demo 比较时不比较校验和，错误的校验和只能由此发现
+ *
+ * @return int 正确为0，错误为1
+ */
+int check_checksum(int idx, const uint8_t *pkt_data, struct pcap_pkthdr *pkt_hdr) {
+    static buf_t seg;
+    if (pkt_hdr->len < sizeof(ether_hdr_t) + sizeof(ip_hdr_t) || swap16(((ether_hdr_t *)pkt_data)->protocol16) != NET_PROTOCOL_IP)
+        return 0;
+    ip_hdr_t *ip = (ip_hdr_t *)(pkt_data + sizeof(ether_hdr_t));
+    size_t hdr_len = ip->hdr_len << 2;
+    size_t total_len = swap16(ip->total_len16);
+    if (total_len < hdr_len || sizeof(ether_hdr_t) + total_len > pkt_hdr->len)
+        return 0;
+    if (checksum16((uint16_t *)ip, hdr_len)) {
+        PRINT_WARN("Packet %d: IP header checksum error\n", idx);
+        return 1;
+    }
+    // 分片的传输层校验和覆盖整个数据报，这里不检查
+    if (swap16(ip->flags_fragment16) & (IP_MORE_FRAGMENT | 0x1fff))
+        return 0;
+    if (ip->protocol != IPPROTO_TCP && ip->protocol != IPPROTO_UDP)
+        return 0;
+    buf_init(&seg, total_len - hdr_len);
+    memcpy(seg.data, (uint8_t *)ip + hdr_len, seg.len);
+    if (ip->protocol == IPPROTO_UDP && (seg.len < sizeof(udp_hdr_t) || ((udp_hdr_t *)seg.data)->checksum16 == 0))
+        return 0;  // UDP 校验和为0表示未计算
+    if (transport_checksum(ip->protocol, &seg, ip->src_ip, ip->dst_ip)) {
+        PRINT_WARN("Packet %d: %s checksum error\n", idx, ip->protocol == IPPROTO_TCP ? "TCP" : "UDP");
+        return 1;
+    }
+    return 0;
+}
+
 int check_pcap() {
     char errbuf[PCAP_ERRBUF_SIZE];
     const char *str_exit = "Exiting pcap file check\n";
@@ -396,6 +435,11 @@ CHECK_PCAP_NEXT_PACKET:
         goto CHECK_PCAP_NEXT_PACKET;
     }
 
+    if (pcap_check_checksum && check_checksum(idx, pkt_data1, pkt_hdr1)) {
+        result = 1;
+        goto CHECK_PCAP_NEXT_PACKET;
+    }
+
     // if (_check_pcap(idx, pkt_data0, pkt_data1, pkt_hdr0, pkt_hdr1)) {
     //     goto CHECK_PCAP_NEXT_PACKET;
     // }
@@ -32,7 +32,7 @@ int main(int argc, char *argv[]) {
         buf.len++;
     }
     PRINT_INFO("Feeding input.\n");
-    ip_out(&buf, net_if_ip, NET_PROTOCOL_TCP);
+    ip_out(&buf, net_if_get(0)->ip, NET_PROTOCOL_TCP);
 
     fclose(in);
     fclose(control_flow);
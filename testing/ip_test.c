@@ -58,7 +58,7 @@ int main(int argc, char *argv[]) {
     log_tab_buf();
     int i = 1;
     PRINT_INFO("Feeding input %02d", i);
-    while ((ret = driver_recv(&buf)) > 0) {
+    while ((ret = driver_recv(net_if_get(0), &buf)) > 0) {
         printf("\b\b%02d", i);
         // printf("\nFeeding input %02d\n",i);
         fprintf(control_flow, "\nRound %02d -----------------------------\n", i++);
@@ -82,7 +82,7 @@ int main(int argc, char *argv[]) {
     if (ret < 0) {
         PRINT_WARN("\nError occur on loading input,exiting\n");
     }
-    driver_close();
+    driver_close(net_if_get(0));
     PRINT_INFO("\nSample input all processed, checking output\n");
 
     fclose(control_flow);
@@ -16,6 +16,7 @@ extern FILE *tcp_fout;
 extern FILE *demo_log;
 extern FILE *out_log;
 extern FILE *arp_log_f;
+extern int pcap_check_checksum;
 
 char *print_ip(uint8_t *ip);
 char *print_mac(uint8_t *mac);
@@ -70,7 +71,7 @@ int main(int argc, char *argv[]) {
     log_tab_buf();
     int i = 1;
     PRINT_INFO("Feeding input %02d", i);
-    while ((ret = driver_recv(&buf)) > 0) {
+    while ((ret = driver_recv(net_if_get(0), &buf)) > 0) {
         printf("\b\b%02d", i);
         fprintf(control_flow, "\nRound %02d -----------------------------\n", i++);
         ethernet_in(&buf);
@@ -79,7 +80,7 @@ int main(int argc, char *argv[]) {
     if (ret < 0) {
         PRINT_WARN("\nError occur on loading input,exiting\n");
     }
-    driver_close();
+    driver_close(net_if_get(0));
     PRINT_INFO("\nSample input all processed, checking output\n");
 
     fclose(control_flow);
@@ -108,6 +109,7 @@ int main(int argc, char *argv[]) {
         return -1;
     }
     check_log();
+    pcap_check_checksum = 1;
     ret = check_pcap() ? 1 : 0;
     PRINT_WARN("For this test, log is only a reference. \
 Your implementation is OK if your pcap file is the same to the demo pcap file.\n");